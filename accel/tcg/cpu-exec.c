@@ -321,6 +321,7 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask)
 {
+    TranslationBlock *tb;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
     uint32_t h;
@@ -337,7 +338,16 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     }
     desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
     h = tb_hash_func(phys_pc, pc, flags, cf_mask, *cpu->trace_dstate);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    if (tb) {
+        /*
+         * Hits here, rather than on every TB entry, tell eviction which
+         * regions are in use: the jump caches are cleared on each TLB
+         * flush, so code that keeps running is looked up again regularly.
+         */
+        tcg_region_mark_used(tb->tc.ptr);
+    }
+    return tb;
 }
 
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr)
@@ -434,6 +444,11 @@ static inline bool cpu_handle_halt(CPUState *cpu)
             cpu_reset_interrupt(cpu, CPU_INTERRUPT_POLL);
             qemu_mutex_unlock_iothread();
         }
+#endif
+#if defined(TARGET_PPC) && !defined(CONFIG_USER_ONLY)
+        if (!cpu_has_work(cpu)) {
+            cpu_ppc_fuzz_clock_idle(cpu->env_ptr);
+        }
 #endif
         if (!cpu_has_work(cpu)) {
             return true;
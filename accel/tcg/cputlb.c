@@ -74,6 +74,9 @@ QEMU_BUILD_BUG_ON(sizeof(target_ulong) > sizeof(run_on_cpu_data));
 QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
 #define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
 
+/* Number of per-vCPU MMIO dispatch slots, see tlb_mmio_dispatch() */
+#define MMIO_DISPATCH_SIZE 64
+
 void tlb_init(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -82,6 +85,19 @@ void tlb_init(CPUState *cpu)
 
     /* Ensure that cpu_reset performs a full flush.  */
     env->tlb_c.dirty = ALL_MMUIDX_BITS;
+
+    cpu->mmio_dispatch = g_new0(MemoryRegionFastDispatch, MMIO_DISPATCH_SIZE);
+}
+
+/* The MMIO dispatch slot of the section number in the low bits of an
+ * IOTLB entry.  A slot is filled whenever a TLB entry for its section is
+ * filled, so a slot that names the section's MemoryRegion is up to date:
+ * TLB entries filled before a memory map change were flushed with it.
+ */
+static inline MemoryRegionFastDispatch *
+tlb_mmio_dispatch(CPUState *cpu, hwaddr iotlb)
+{
+    return &cpu->mmio_dispatch[iotlb & (MMIO_DISPATCH_SIZE - 1)];
 }
 
 /* flush_all_helper: run fn across all cpus
@@ -527,6 +543,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     hwaddr iotlb, xlat, sz, paddr_page;
     target_ulong vaddr_page;
     int asidx = cpu_asidx_from_attrs(cpu, attrs);
+    bool is_io = false;
 
     assert_cpu_is_self(cpu);
 
@@ -560,6 +577,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
         /* IO memory case */
         address |= TLB_MMIO;
         addend = 0;
+        is_io = true;
     } else {
         /* TLB_MMIO for rom/romd handled below */
         addend = (uintptr_t)memory_region_get_ram_ptr(section->mr) + xlat;
@@ -568,6 +586,10 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     code_address = address;
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr_page,
                                             paddr_page, xlat, prot, &address);
+    if (is_io) {
+        memory_region_fast_dispatch_init(tlb_mmio_dispatch(cpu, iotlb),
+                                         section->mr);
+    }
 
     index = tlb_index(env, mmu_idx, vaddr_page);
     te = tlb_entry(env, mmu_idx, vaddr_page);
@@ -683,6 +705,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr mr_offset;
     MemoryRegionSection *section;
+    MemoryRegionFastDispatch *fd;
     MemoryRegion *mr;
     uint64_t val;
     bool locked = false;
@@ -726,8 +749,14 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         qemu_mutex_lock_iothread();
         locked = true;
     }
-    r = memory_region_dispatch_read(mr, mr_offset,
-                                    &val, size, iotlbentry->attrs);
+    fd = tlb_mmio_dispatch(cpu, iotlbentry->addr);
+    if (fd->mr == mr &&
+        memory_region_fast_dispatch_read(fd, mr_offset, &val, size)) {
+        r = MEMTX_OK;
+    } else {
+        r = memory_region_dispatch_read(mr, mr_offset,
+                                        &val, size, iotlbentry->attrs);
+    }
     if (r != MEMTX_OK) {
         hwaddr physaddr = mr_offset +
             section->offset_within_address_space -
@@ -751,6 +780,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr mr_offset;
     MemoryRegionSection *section;
+    MemoryRegionFastDispatch *fd;
     MemoryRegion *mr;
     bool locked = false;
     MemTxResult r;
@@ -792,8 +822,14 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         qemu_mutex_lock_iothread();
         locked = true;
     }
-    r = memory_region_dispatch_write(mr, mr_offset,
-                                     val, size, iotlbentry->attrs);
+    fd = tlb_mmio_dispatch(cpu, iotlbentry->addr);
+    if (fd->mr == mr &&
+        memory_region_fast_dispatch_write(fd, mr_offset, val, size)) {
+        r = MEMTX_OK;
+    } else {
+        r = memory_region_dispatch_write(mr, mr_offset,
+                                         val, size, iotlbentry->attrs);
+    }
     if (r != MEMTX_OK) {
         hwaddr physaddr = mr_offset +
             section->offset_within_address_space -
@@ -906,6 +942,26 @@ void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
     }
 }
 
+/* Probe for whether the specified guest read access is permitted.
+ * As for probe_write, a fault is raised exactly as for a real load
+ * (and we will not return); otherwise there will be a valid entry in
+ * the TLB for this access on return.
+ */
+void probe_read(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
+                uintptr_t retaddr)
+{
+    uintptr_t index = tlb_index(env, mmu_idx, addr);
+    CPUTLBEntry *entry = tlb_entry(env, mmu_idx, addr);
+
+    if (!tlb_hit(entry->addr_read, addr)) {
+        /* TLB entry is for a different page */
+        if (!VICTIM_TLB_HIT(addr_read, addr)) {
+            tlb_fill(ENV_GET_CPU(env), addr, size, MMU_DATA_LOAD,
+                     mmu_idx, retaddr);
+        }
+    }
+}
+
 /* Probe for a read-modify-write atomic operation.  Do not allow unaligned
  * operations, or io operations to proceed.  Return the host address.  */
 static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
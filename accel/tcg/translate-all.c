@@ -95,14 +95,20 @@
 #define assert_memory_lock() tcg_debug_assert(have_mmap_lock())
 #endif
 
-#define SMC_BITMAP_USE_THRESHOLD 10
+/* Once a page holding code has been written this many times, track which
+ * of its bytes are covered by TBs, so that writes to data sharing the page
+ * with code don't have to walk the TB list.
+ */
+#define SMC_BITMAP_USE_THRESHOLD 2
 
 typedef struct PageDesc {
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
 #ifdef CONFIG_SOFTMMU
     /* in order to optimize self modifying code, we count the number
-       of lookups we do to a given page to use a bitmap */
+       of lookups we do to a given page to use a bitmap.  The bitmap is
+       kept up to date as TBs are added to the page; bits of invalidated
+       TBs stay set until a write to them finds no TB and rebuilds it. */
     unsigned long *code_bitmap;
     unsigned int code_write_count;
 #else
@@ -1421,8 +1427,10 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
+ *
+ * Returns false if the TB had already been removed.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static bool do_tb_phys_remove(TranslationBlock *tb, bool rm_from_page_list)
 {
     CPUState *cpu;
     PageDesc *p;
@@ -1442,18 +1450,22 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
                      tb->trace_vcpu_dstate);
     if (!(tb->cflags & CF_NOCACHE) &&
         !qht_remove(&tb_ctx.htable, tb, h)) {
-        return;
+        return false;
     }
 
     /* remove the TB from the page list */
     if (rm_from_page_list) {
         p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
         tb_page_remove(p, tb);
-        invalidate_page_bitmap(p);
+        if (!p->first_tb) {
+            invalidate_page_bitmap(p);
+        }
         if (tb->page_addr[1] != -1) {
             p = page_find(tb->page_addr[1] >> TARGET_PAGE_BITS);
             tb_page_remove(p, tb);
-            invalidate_page_bitmap(p);
+            if (!p->first_tb) {
+                invalidate_page_bitmap(p);
+            }
         }
     }
 
@@ -1471,9 +1483,15 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
+    return true;
+}
 
-    atomic_set(&tcg_ctx->tb_phys_invalidate_count,
-               tcg_ctx->tb_phys_invalidate_count + 1);
+static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+{
+    if (do_tb_phys_remove(tb, rm_from_page_list)) {
+        atomic_set(&tcg_ctx->tb_phys_invalidate_count,
+                   tcg_ctx->tb_phys_invalidate_count + 1);
+    }
 }
 
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
@@ -1496,31 +1514,117 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+/* Evict a quarter of the regions each time the cache fills up */
+#define TB_EVICT_FRACTION 4
+
+/*
+ * Like tb_phys_invalidate(tb, -1), but the TB's code is not stale, so it is
+ * not counted as an invalidation.
+ */
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    size_t *nb_tbs = data;
+    bool removed;
+
+    /* Skip TBs that are gone already, such as executed CF_NOCACHE ones */
+    if (tb_cflags(tb) & CF_INVALID) {
+        return false;
+    }
+    if (tb->page_addr[0] != -1) {
+        page_lock_tb(tb);
+        removed = do_tb_phys_remove(tb, true);
+        page_unlock_tb(tb);
+    } else {
+        removed = do_tb_phys_remove(tb, false);
+    }
+    if (removed) {
+        (*nb_tbs)++;
+    }
+    return false;
+}
+
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    size_t nb_regions, nb_tbs = 0;
+
+    mmap_lock();
+    /* Nothing to do if a flush or another eviction made room meanwhile */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int ||
+        tcg_region_available()) {
+        goto done;
+    }
+
+    nb_regions = tcg_region_evict(MAX(tcg_region_count() / TB_EVICT_FRACTION,
+                                      1),
+                                  tb_evict_iter, &nb_tbs);
+    if (nb_regions == 0) {
+        mmap_unlock();
+        do_tb_flush(cpu, tb_flush_count);
+        return;
+    }
+
+    atomic_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    atomic_set(&tb_ctx.tb_evict_regions,
+               tb_ctx.tb_evict_regions + nb_regions);
+    atomic_set(&tb_ctx.tb_evict_tbs, tb_ctx.tb_evict_tbs + nb_tbs);
+
+done:
+    mmap_unlock();
+}
+
+/*
+ * Make room in a full code cache by retiring some of its regions, and only
+ * the jumps into them. Regions go oldest first, but one whose TBs were
+ * looked up since the last eviction is kept for another round; hot TBs
+ * that get evicted anyway are translated again into a fresh region. Falls
+ * back to tb_flush() if there is no region to retire.
+ */
+static void tb_evict(CPUState *cpu)
+{
+    unsigned tb_flush_count = atomic_mb_read(&tb_ctx.tb_flush_count);
+
+    async_safe_run_on_cpu(cpu, do_tb_evict,
+                          RUN_ON_CPU_HOST_INT(tb_flush_count));
+}
+
 #ifdef CONFIG_SOFTMMU
+/* call with @p->lock held */
+static void page_bitmap_add_tb(PageDesc *p, TranslationBlock *tb, int n)
+{
+    int tb_start, tb_end;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        /* NOTE: tb_end may be after the end of the page, but
+           it is not a problem */
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+}
+
 /* call with @p->lock held */
 static void build_page_bitmap(PageDesc *p)
 {
-    int n, tb_start, tb_end;
     TranslationBlock *tb;
+    int n;
 
     assert_page_locked(p);
-    p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
+    if (p->code_bitmap) {
+        bitmap_zero(p->code_bitmap, TARGET_PAGE_SIZE);
+    } else {
+        p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
+    }
 
     PAGE_FOR_EACH_TB(p, tb, n) {
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-             }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
-        }
-        bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+        page_bitmap_add_tb(p, tb, n);
     }
 }
 #endif
@@ -1545,7 +1649,11 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     page_already_protected = p->first_tb != (uintptr_t)NULL;
 #endif
     p->first_tb = (uintptr_t)tb | n;
-    invalidate_page_bitmap(p);
+#ifdef CONFIG_SOFTMMU
+    if (p->code_bitmap) {
+        page_bitmap_add_tb(p, tb, n);
+    }
+#endif
 
 #if defined(CONFIG_USER_ONLY)
     if (p->flags & PAGE_WRITE) {
@@ -1691,8 +1799,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction (or flush) must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1850,6 +1958,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     tb_page_addr_t tb_start, tb_end;
+    bool invalidated = false;
     int n;
 #ifdef TARGET_HAS_PRECISE_SMC
     CPUState *cpu = current_cpu;
@@ -1911,6 +2020,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
             }
 #endif /* TARGET_HAS_PRECISE_SMC */
             tb_phys_invalidate__locked(tb);
+            invalidated = true;
         }
     }
 #if !defined(CONFIG_USER_ONLY)
@@ -1918,8 +2028,15 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     if (!p->first_tb) {
         invalidate_page_bitmap(p);
         tlb_unprotect_code(start);
+    } else if (is_cpu_write_access && !invalidated && p->code_bitmap) {
+        /* the bitmap still had bits of TBs invalidated earlier */
+        build_page_bitmap(p);
     }
 #endif
+    if (is_cpu_write_access && invalidated) {
+        atomic_set(&tcg_ctx->smc_invalidate_count,
+                   tcg_ctx->smc_invalidate_count + 1);
+    }
 #ifdef TARGET_HAS_PRECISE_SMC
     if (current_tb_modified) {
         page_collection_unlock(pages);
@@ -2013,7 +2130,8 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
     }
 
     assert_page_locked(p);
-    if (!p->code_bitmap &&
+    atomic_set(&tcg_ctx->smc_write_count, tcg_ctx->smc_write_count + 1);
+    if (!p->code_bitmap && p->first_tb &&
         ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
         build_page_bitmap(p);
     }
@@ -2026,6 +2144,8 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
         if (b & ((1 << len) - 1)) {
             goto do_invalidate;
         }
+        atomic_set(&tcg_ctx->smc_filtered_count,
+                   tcg_ctx->smc_filtered_count + 1);
     } else {
     do_invalidate:
         tb_invalidate_phys_page_range__locked(pages, p, start, start + len, 1);
@@ -2287,6 +2407,7 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t smc_writes, smc_filtered, smc_inval;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2321,8 +2442,16 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %u\n",
                 atomic_read(&tb_ctx.tb_flush_count));
+    cpu_fprintf(f, "TB eviction count   %u (%zu regions, %zu TBs)\n",
+                atomic_read(&tb_ctx.tb_evict_count),
+                atomic_read(&tb_ctx.tb_evict_regions),
+                atomic_read(&tb_ctx.tb_evict_tbs));
     cpu_fprintf(f, "TB invalidate count %zu\n", tcg_tb_phys_invalidate_count());
 
+    tcg_smc_counts(&smc_writes, &smc_filtered, &smc_inval);
+    cpu_fprintf(f, "SMC writes          %zu (%zu skipped by bitmap, "
+                "%zu invalidating)\n", smc_writes, smc_filtered, smc_inval);
+
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     cpu_fprintf(f, "TLB full flushes    %zu\n", flush_full);
     cpu_fprintf(f, "TLB partial flushes %zu\n", flush_part);
@@ -86,6 +86,8 @@ int aflGotLog = 0;              /* we've seen dmesg logging */
 const char *aflFile = "/tmp/work";
 unsigned long aflPanicAddr = (unsigned long)-1;
 unsigned long aflDmesgAddr = (unsigned long)-1;
+unsigned long aflFuzzClock = 0;   /* guest ns per block, 0 = host clock */
+int aflIdleWarp = 0;              /* skip the clock while all vCPUs idle */
 
 /* Set in the child process in forkserver mode: */
 
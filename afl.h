@@ -6,6 +6,8 @@
 extern const char *aflFile;
 extern unsigned long aflPanicAddr;
 extern unsigned long aflDmesgAddr;
+extern unsigned long aflFuzzClock;
+extern int aflIdleWarp;
 
 extern int aflEnableTicks;
 extern int aflStart;
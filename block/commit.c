@@ -527,3 +527,44 @@ ro_cleanup:
 
     return ret;
 }
+
+/*
+ * Drops everything written to @bs so that it reads like its backing file
+ * again.  Unlike bdrv_commit() nothing is copied anywhere, this is for
+ * rolling a disposable overlay back.  Drivers that know what was written
+ * since they were last empty (qcow2 with fast-reset, privmem) only touch
+ * those areas.
+ */
+int bdrv_make_empty(BlockDriverState *bs, Error **errp)
+{
+    BlockDriver *drv = bs->drv;
+    int ret;
+
+    if (!drv) {
+        error_setg(errp, "Node '%s' has no medium", bdrv_get_node_name(bs));
+        return -ENOMEDIUM;
+    }
+
+    if (!drv->bdrv_make_empty) {
+        error_setg(errp, "Driver '%s' does not support emptying images",
+                   drv->format_name);
+        return -ENOTSUP;
+    }
+
+    if (bdrv_is_read_only(bs)) {
+        error_setg(errp, "Node '%s' is read-only", bdrv_get_node_name(bs));
+        return -EACCES;
+    }
+
+    bdrv_drained_begin(bs);
+    ret = drv->bdrv_make_empty(bs);
+    if (ret == 0) {
+        ret = bdrv_flush(bs);
+    }
+    bdrv_drained_end(bs);
+
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not empty '%s'", bs->filename);
+    }
+    return ret;
+}
@@ -27,6 +27,7 @@
 #include "sysemu/block-backend.h"
 #include "block/aio-wait.h"
 #include "block/blockjob.h"
+#include "block/raw-aio.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
 #include "qemu/cutils.h"
@@ -584,6 +585,30 @@ void bdrv_drain_all(void)
     bdrv_drain_all_end();
 }
 
+/*
+ * Called in the child of a fork() that keeps using the block layer, i.e.
+ * in the AFL fork server children.  The parent must have drained all
+ * requests with bdrv_drain_all() before forking.
+ */
+void bdrv_fork_child(void)
+{
+    BlockDriverState *bs = NULL;
+
+#ifdef CONFIG_LINUX_IO_URING
+    luring_fork_child();
+#endif
+
+    while ((bs = bdrv_next_all_states(bs))) {
+        AioContext *aio_context = bdrv_get_aio_context(bs);
+
+        if (bs->drv && bs->drv->bdrv_fork_child) {
+            aio_context_acquire(aio_context);
+            bs->drv->bdrv_fork_child(bs);
+            aio_context_release(aio_context);
+        }
+    }
+}
+
 /**
  * Remove an active request from the tracked requests list
  *
@@ -1265,6 +1290,14 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
                 goto err;
             }
 
+            /* The data is unchanged, so this is not a write for the dirty
+             * bitmaps of the node's users, but the area is now allocated in
+             * this layer.  Let the driver know in case it tracks that.
+             */
+            if (drv->bdrv_copy_on_read_written) {
+                drv->bdrv_copy_on_read_written(bs, cluster_offset, pnum);
+            }
+
             qemu_iovec_from_buf(qiov, progress, bounce_buffer + skip_bytes,
                                 pnum - skip_bytes);
         } else {
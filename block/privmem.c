@@ -13,39 +13,86 @@
 #include <sys/mman.h>
 
 #include "qemu/osdep.h"
-
-#define ZLIB_CONST
-#include <zlib.h>
-
 #include "block/block_int.h"
 #include "block/qdict.h"
-#include "sysemu/block-backend.h"
 #include "qemu/module.h"
-#include "qemu/error-report.h"
+#include "qemu/bitmap.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
-#include "qapi/qapi-events-block-core.h"
-#include "qapi/qmp/qdict.h"
-#include "qapi/qmp/qstring.h"
 #include "trace.h"
-#include "qemu/option_int.h"
-#include "qemu/cutils.h"
-#include "qemu/bswap.h"
-#include "qapi/qobject-input-visitor.h"
-#include "qapi/qapi-visit-block-core.h"
-#include "crypto.h"
-#include "block/thread-pool.h"
-
 
+/*
+ * The image is tracked in clusters.  These bitmaps describe each one:
+ *
+ *  - base_zero_map: the cluster is all zeroes in the backing image.  Holes
+ *    are found at open time; in file mode the data clusters are listed in
+ *    unscanned_map and only checked for zeroes when first accessed.
+ *  - zero_map: the cluster currently reads as zeroes.  Reads of such a
+ *    cluster never touch the mapping, and zero writes to it are dropped,
+ *    so unwritten parts of a sparse image are never faulted in.
+ *  - dirty_map: the cluster was written since open, the last fork or the
+ *    last bdrv_make_empty().  In overlay mode its data lives in the overlay.
+ *  - fork_map: the cluster was written before the last fork, so its state
+ *    at fork is not the backing image.  In overlay mode its data lives in
+ *    the overlay too.
+ *  - reset_zero_map: the zero state that bdrv_make_empty() goes back to,
+ *    i.e. base_zero_map, or zero_map at the last fork.
+ *
+ * All of them are plain heap memory, so after a fork every child gets its
+ * own copy.  The child starts with no dirty clusters and resets go back to
+ * the state at fork: the contents of a fork_map cluster are saved in
+ * fork_saved before the child first changes them.
+ *
+ * In file mode the image is mmapped MAP_PRIVATE and written in place.  In
+ * overlay mode, which is used for a child node (qcow2, raw, ...) or with
+ * hugepages=on, dirty clusters are copied into an anonymous overlay and
+ * the backing image is only read.
+ */
 
+#define PRIVMEM_DEFAULT_CLUSTER_SIZE (64 * KiB)
+#define PRIVMEM_MAX_CLUSTER_SIZE     (2 * MiB)
 
-#include "block/block_int.h"
+typedef struct PrivmemStats {
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t zero_read_bytes;   /* reads served from the zero map */
+    uint64_t zero_write_bytes;  /* zero writes dropped on zero clusters */
+    uint64_t copy_ups;          /* clusters copied into the overlay */
+    uint64_t resets;
+} PrivmemStats;
 
 typedef struct {
     int fd;
-    char *buf;
+    char *buf;              /* file mode: private mapping of the image */
     size_t size;
+
+    char *overlay;          /* overlay mode: anonymous COW overlay */
+    size_t overlay_size;
+
+    uint64_t cluster_size;
+    uint64_t nb_clusters;
+    unsigned long *base_zero_map;
+    unsigned long *unscanned_map;
+    unsigned long *zero_map;
+    unsigned long *dirty_map;
+    unsigned long *fork_map;
+    unsigned long *reset_zero_map;
+    GHashTable *fork_saved;     /* cluster -> contents at the last fork */
+    uint8_t *bounce;            /* file mode: buffer for the lazy scan */
+
+    CoMutex lock;           /* serialises writes and copy-ups */
+    PrivmemStats stats;
 } BDRVCOWState;
 
+enum {
+    PRIVMEM_ZERO,
+    PRIVMEM_OVERLAY,
+    PRIVMEM_BASE,
+};
+
 static QemuOptsList runtime_opts = {
     .name = "privmem",
     .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
@@ -53,50 +100,304 @@ static QemuOptsList runtime_opts = {
         {
             .name = "filename",
             .type = QEMU_OPT_STRING,
-            .help = "",
+            .help = "Flat image file to map privately",
+        },
+        {
+            .name = "cluster-size",
+            .type = QEMU_OPT_SIZE,
+            .help = "Granularity of zero and dirty tracking",
+        },
+        {
+            .name = "hugepages",
+            .type = QEMU_OPT_BOOL,
+            .help = "Keep written clusters in a transparent hugepage "
+                    "backed overlay",
         },
         { /* end of list */ }
     },
 };
 
+static inline uint64_t privmem_cluster_bytes(BDRVCOWState *s, uint64_t cluster)
+{
+    return MIN(s->cluster_size, s->size - cluster * s->cluster_size);
+}
+
+/* Drop the private copies of a page range.  On Linux the range then reads
+ * back as the file contents for a file mapping and as zeroes for an
+ * anonymous one.
+ */
+static bool privmem_drop_pages(void *addr, size_t len)
+{
+#ifdef CONFIG_LINUX
+    return madvise(addr, len, MADV_DONTNEED) == 0;
+#else
+    return false;
+#endif
+}
+
+static int privmem_alloc_overlay(BDRVCOWState *s, bool hugepages,
+                                 Error **errp)
+{
+    size_t align = hugepages ? PRIVMEM_MAX_CLUSTER_SIZE
+                             : qemu_real_host_page_size;
+    size_t size = QEMU_ALIGN_UP(s->nb_clusters * s->cluster_size, align);
+    uintptr_t start;
+    char *ptr;
+
+    /* Over-allocate so that the overlay can be aligned for THP */
+    ptr = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        error_setg_errno(errp, errno, "Could not allocate privmem overlay");
+        return -ENOMEM;
+    }
+    start = QEMU_ALIGN_UP((uintptr_t)ptr, align);
+    if (start != (uintptr_t)ptr) {
+        munmap(ptr, start - (uintptr_t)ptr);
+    }
+    munmap((char *)start + size, (uintptr_t)ptr + align - start);
+
+    s->overlay = (char *)start;
+    s->overlay_size = size;
+    if (hugepages) {
+        qemu_madvise(s->overlay, size, QEMU_MADV_HUGEPAGE);
+    }
+    return 0;
+}
+
+/* Find the holes of a flat file with SEEK_DATA/SEEK_HOLE.  The data is not
+ * read here, privmem_scan_cluster() checks each data cluster for zeroes
+ * when it is first accessed.
+ */
+static void privmem_scan_file(BDRVCOWState *s)
+{
+    uint64_t cluster = 0;
+
+#ifdef SEEK_DATA
+    while (cluster < s->nb_clusters) {
+        off_t data, hole;
+        uint64_t first, end;
+
+        data = lseek(s->fd, cluster * s->cluster_size, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                /* Only a hole up to the end of the file */
+                bitmap_set(s->base_zero_map, cluster,
+                           s->nb_clusters - cluster);
+                return;
+            }
+            break;
+        }
+        hole = lseek(s->fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            hole = s->size;
+        }
+
+        first = data / s->cluster_size;
+        end = DIV_ROUND_UP(hole, s->cluster_size);
+        if (first > cluster) {
+            bitmap_set(s->base_zero_map, cluster, first - cluster);
+        }
+        bitmap_set(s->unscanned_map, first, end - first);
+        cluster = end;
+    }
+#endif
+    if (cluster < s->nb_clusters) {
+        bitmap_set(s->unscanned_map, cluster, s->nb_clusters - cluster);
+    }
+}
+
+/* Check a data cluster of a flat file for zeroes.  It is read with pread()
+ * so that the check does not populate the mapping.  Unscanned clusters
+ * have never been written, so their state is still that of the file.
+ */
+static void privmem_scan_cluster(BDRVCOWState *s, uint64_t cluster)
+{
+    uint64_t bytes = privmem_cluster_bytes(s, cluster);
+
+    if (!s->unscanned_map || !test_bit(cluster, s->unscanned_map)) {
+        return;
+    }
+    clear_bit(cluster, s->unscanned_map);
+
+    if (pread(s->fd, s->bounce, bytes, cluster * s->cluster_size) == bytes &&
+        buffer_is_zero(s->bounce, bytes)) {
+        set_bit(cluster, s->base_zero_map);
+        set_bit(cluster, s->reset_zero_map);
+        set_bit(cluster, s->zero_map);
+    }
+}
+
+static void privmem_scan_child(BlockDriverState *bs)
+{
+    BDRVCOWState *s = bs->opaque;
+    int64_t offset = 0;
+
+    while (offset < s->size) {
+        int64_t pnum;
+        int ret;
+
+        ret = bdrv_block_status_above(bs->file->bs, NULL, offset,
+                                      s->size - offset, &pnum, NULL, NULL);
+        if (ret < 0 || pnum == 0) {
+            return;
+        }
+        if (ret & BDRV_BLOCK_ZERO) {
+            /* Only whole clusters can be marked */
+            uint64_t first = DIV_ROUND_UP(offset, s->cluster_size);
+            uint64_t end = offset + pnum == s->size ? s->nb_clusters
+                           : (offset + pnum) / s->cluster_size;
+            if (end > first) {
+                bitmap_set(s->base_zero_map, first, end - first);
+            }
+        }
+        offset += pnum;
+    }
+}
+
+static int privmem_open_file(BDRVCOWState *s, const char *filename,
+                             Error **errp)
+{
+    struct stat sb;
+
+    s->fd = qemu_open(filename, O_RDONLY);
+    if (s->fd < 0) {
+        int ret = -errno;
+        error_setg_errno(errp, -ret, "Could not open '%s'", filename);
+        return ret;
+    }
+    if (fstat(s->fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+        error_setg(errp, "'%s' is not a regular file", filename);
+        return -EINVAL;
+    }
+    s->size = sb.st_size;
+    s->buf = mmap(0, sb.st_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_NORESERVE, s->fd, 0);
+    if (s->buf == MAP_FAILED) {
+        s->buf = NULL;
+        error_setg_errno(errp, errno, "Could not map '%s'", filename);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void privmem_free(BDRVCOWState *s)
+{
+    if (s->overlay) {
+        munmap(s->overlay, s->overlay_size);
+    }
+    if (s->buf) {
+        munmap(s->buf, s->size);
+    }
+    if (s->fd >= 0) {
+        qemu_close(s->fd);
+    }
+    if (s->fork_saved) {
+        g_hash_table_destroy(s->fork_saved);
+    }
+    qemu_vfree(s->bounce);
+    g_free(s->base_zero_map);
+    g_free(s->unscanned_map);
+    g_free(s->zero_map);
+    g_free(s->dirty_map);
+    g_free(s->fork_map);
+    g_free(s->reset_zero_map);
+}
+
 static int privmem_file_open(BlockDriverState *bs, QDict *options, int flags,
                           Error **errp)
 {
     QemuOpts *opts;
     BDRVCOWState *s = bs->opaque;
-    const char *filename, *p;
-    struct stat sb;
-    int ret = 0;
+    Error *local_err = NULL;
+    const char *filename;
+    bool hugepages;
+    int64_t len;
+    int ret;
 
+    s->fd = -1;
     opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
-    qemu_opts_absorb_qdict(opts, options, &error_abort);
-    filename = qemu_opt_get(opts, "filename");
-    if (error_abort) {
-        error_propagate(errp, error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
         ret = -EINVAL;
         goto fail;
     }
 
-    /* strip "privmem:". XXX whats the proper way to handle this? */
-    p = strchr(filename, ':');
-    if(p)
-        filename = p + 1;
-
-    s->fd = qemu_open(filename, O_RDONLY);
-    if (fstat(s->fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
-        perror(filename);
+    s->cluster_size = qemu_opt_get_size(opts, "cluster-size",
+                                        PRIVMEM_DEFAULT_CLUSTER_SIZE);
+    if (!is_power_of_2(s->cluster_size) ||
+        s->cluster_size < qemu_real_host_page_size ||
+        s->cluster_size > PRIVMEM_MAX_CLUSTER_SIZE) {
+        error_setg(errp, "cluster-size must be a power of two between the "
+                   "host page size and %" PRId64, PRIVMEM_MAX_CLUSTER_SIZE);
         ret = -EINVAL;
         goto fail;
     }
-    s->size = sb.st_size;
-    s->buf = mmap(0, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, s->fd, 0);
-    if (s->buf == MAP_FAILED) {
-        perror("mmap");
-        ret = -EINVAL;
-        goto fail;
+    hugepages = qemu_opt_get_bool(opts, "hugepages", false);
+
+    filename = qemu_opt_get(opts, "filename");
+    if (filename) {
+        strstart(filename, "privmem:", &filename);
+        ret = privmem_open_file(s, filename, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+    } else {
+        /* COW overlay over any other node; it is never written */
+        qdict_set_default_str(options, "image." BDRV_OPT_READ_ONLY, "on");
+        bs->file = bdrv_open_child(NULL, options, "image", bs, &child_format,
+                                   false, &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            ret = -EINVAL;
+            goto fail;
+        }
+        len = bdrv_getlength(bs->file->bs);
+        if (len < 0) {
+            error_setg_errno(errp, -len, "Could not get image size");
+            ret = len;
+            goto fail;
+        }
+        s->size = len;
+    }
+
+    s->nb_clusters = DIV_ROUND_UP(s->size, s->cluster_size);
+    s->base_zero_map = bitmap_new(s->nb_clusters);
+    s->zero_map = bitmap_new(s->nb_clusters);
+    s->dirty_map = bitmap_new(s->nb_clusters);
+    s->fork_map = bitmap_new(s->nb_clusters);
+    s->reset_zero_map = bitmap_new(s->nb_clusters);
+    s->fork_saved = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                          NULL, g_free);
+
+    if (!s->buf || hugepages) {
+        ret = privmem_alloc_overlay(s, hugepages, errp);
+        if (ret < 0) {
+            goto fail;
+        }
     }
 
+    if (s->buf) {
+        s->unscanned_map = bitmap_new(s->nb_clusters);
+        s->bounce = qemu_memalign(qemu_real_host_page_size, s->cluster_size);
+        privmem_scan_file(s);
+    } else {
+        privmem_scan_child(bs);
+    }
+    bitmap_copy(s->zero_map, s->base_zero_map, s->nb_clusters);
+    bitmap_copy(s->reset_zero_map, s->base_zero_map, s->nb_clusters);
+
+    qemu_co_mutex_init(&s->lock);
+    trace_privmem_open(bs, s->size, s->cluster_size,
+                       bitmap_count_one(s->zero_map, s->nb_clusters),
+                       s->nb_clusters, !!s->overlay);
+    ret = 0;
+
 fail:
+    if (ret < 0) {
+        privmem_free(s);
+    }
     qemu_opts_del(opts);
     return ret;
 }
@@ -104,8 +405,11 @@ fail:
 static void privmem_close(BlockDriverState *bs)
 {
     BDRVCOWState *s = bs->opaque;
-    munmap(s->buf, s->size);
-    close(s->fd);
+
+    trace_privmem_close(bs, s->stats.read_bytes, s->stats.write_bytes,
+                        s->stats.zero_read_bytes, s->stats.zero_write_bytes,
+                        s->stats.copy_ups, s->stats.resets);
+    privmem_free(s);
 }
 
 static int64_t privmem_getlength(BlockDriverState *bs)
@@ -114,21 +418,390 @@ static int64_t privmem_getlength(BlockDriverState *bs)
     return s->size;
 }
 
-/* no bounds checking. Possible for guest to do a lot of reading/writing it shouldn't */
+static void privmem_child_perm(BlockDriverState *bs, BdrvChild *c,
+                               const BdrvChildRole *role,
+                               BlockReopenQueue *reopen_queue,
+                               uint64_t perm, uint64_t shared,
+                               uint64_t *nperm, uint64_t *nshared)
+{
+    /* Writes stay in the overlay, the child node is only ever read */
+    *nperm = BLK_PERM_CONSISTENT_READ;
+    *nshared = BLK_PERM_ALL;
+}
+
+static int privmem_check_request(BDRVCOWState *s, uint64_t offset,
+                                 uint64_t bytes)
+{
+    if (offset > s->size || bytes > s->size - offset) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static bool privmem_in_overlay(BDRVCOWState *s, uint64_t cluster)
+{
+    return s->overlay && (test_bit(cluster, s->dirty_map) ||
+                          test_bit(cluster, s->fork_map));
+}
+
+static int privmem_cluster_kind(BDRVCOWState *s, uint64_t cluster)
+{
+    privmem_scan_cluster(s, cluster);
+    if (test_bit(cluster, s->zero_map)) {
+        return PRIVMEM_ZERO;
+    }
+    if (privmem_in_overlay(s, cluster)) {
+        return PRIVMEM_OVERLAY;
+    }
+    return PRIVMEM_BASE;
+}
+
+/* Return how the data at @offset is stored, and in @pnum how many of the
+ * following @bytes are stored the same way.
+ */
+static int privmem_run(BDRVCOWState *s, uint64_t offset, uint64_t bytes,
+                       uint64_t *pnum)
+{
+    uint64_t cluster = offset / s->cluster_size;
+    uint64_t end = offset + bytes;
+    uint64_t next = (cluster + 1) * s->cluster_size;
+    int kind = privmem_cluster_kind(s, cluster);
+
+    while (next < end && privmem_cluster_kind(s, ++cluster) == kind) {
+        next += s->cluster_size;
+    }
+    *pnum = MIN(next, end) - offset;
+    return kind;
+}
+
+static bool privmem_iov_is_zero(QEMUIOVector *qiov, size_t offset, size_t bytes)
+{
+    int i;
+
+    for (i = 0; i < qiov->niov && bytes; i++) {
+        struct iovec *iov = &qiov->iov[i];
+        size_t len;
+
+        if (offset >= iov->iov_len) {
+            offset -= iov->iov_len;
+            continue;
+        }
+        len = MIN(iov->iov_len - offset, bytes);
+        if (!buffer_is_zero(iov->iov_base + offset, len)) {
+            return false;
+        }
+        offset = 0;
+        bytes -= len;
+    }
+    return true;
+}
+
 static coroutine_fn int privmem_read(BlockDriverState *bs, uint64_t offset,
                                       uint64_t bytes, QEMUIOVector *qiov,
                                       int flags)
 {
     BDRVCOWState *s = bs->opaque;
-    return qemu_iovec_from_buf(qiov,0,s->buf+offset,bytes);
+    uint64_t qiov_offset = 0;
+    int ret;
+
+    ret = privmem_check_request(s, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->stats.read_bytes += bytes;
+    while (bytes) {
+        QEMUIOVector local_qiov;
+        uint64_t n;
+
+        switch (privmem_run(s, offset, bytes, &n)) {
+        case PRIVMEM_ZERO:
+            qemu_iovec_memset(qiov, qiov_offset, 0, n);
+            s->stats.zero_read_bytes += n;
+            break;
+        case PRIVMEM_OVERLAY:
+            qemu_iovec_from_buf(qiov, qiov_offset, s->overlay + offset, n);
+            break;
+        case PRIVMEM_BASE:
+            if (s->buf) {
+                qemu_iovec_from_buf(qiov, qiov_offset, s->buf + offset, n);
+                break;
+            }
+            qemu_iovec_init(&local_qiov, qiov->niov);
+            qemu_iovec_concat(&local_qiov, qiov, qiov_offset, n);
+            ret = bdrv_co_preadv(bs->file, offset, n, &local_qiov, 0);
+            qemu_iovec_destroy(&local_qiov);
+            if (ret < 0) {
+                return ret;
+            }
+            break;
+        }
+        offset += n;
+        qiov_offset += n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+/* Bring a clean cluster into the overlay before part of it is written.
+ * Clean clusters of the overlay are always zero, so zero clusters need no
+ * copy.
+ */
+static int coroutine_fn privmem_copy_up(BlockDriverState *bs, uint64_t cluster)
+{
+    BDRVCOWState *s = bs->opaque;
+    uint64_t offset = cluster * s->cluster_size;
+    uint64_t bytes = privmem_cluster_bytes(s, cluster);
+    int ret;
+
+    if (test_bit(cluster, s->zero_map)) {
+        return 0;
+    }
+    if (s->buf) {
+        memcpy(s->overlay + offset, s->buf + offset, bytes);
+    } else {
+        ret = bdrv_co_pread(bs->file, offset, bytes, s->overlay + offset, 0);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    s->stats.copy_ups++;
+    return 0;
+}
+
+/* Keep the contents a cluster had at fork before the child first changes
+ * it, so that bdrv_make_empty() can bring them back.  Clusters that were
+ * zero at fork need no copy.
+ */
+static void privmem_save_fork_cluster(BDRVCOWState *s, uint64_t cluster)
+{
+    uint64_t offset = cluster * s->cluster_size;
+    uint64_t bytes = privmem_cluster_bytes(s, cluster);
+    gpointer key = GSIZE_TO_POINTER(cluster);
+
+    if (!test_bit(cluster, s->fork_map) ||
+        test_bit(cluster, s->dirty_map) ||
+        test_bit(cluster, s->reset_zero_map) ||
+        g_hash_table_contains(s->fork_saved, key)) {
+        return;
+    }
+    g_hash_table_insert(s->fork_saved, key,
+                        g_memdup((s->overlay ? s->overlay : s->buf) + offset,
+                                 bytes));
+}
+
+static void privmem_zero_cluster(BDRVCOWState *s, uint64_t cluster)
+{
+    uint64_t offset = cluster * s->cluster_size;
+    uint64_t bytes = privmem_cluster_bytes(s, cluster);
+
+    if (s->overlay) {
+        if (!privmem_drop_pages(s->overlay + offset, s->cluster_size)) {
+            memset(s->overlay + offset, 0, bytes);
+        }
+    } else if (!test_bit(cluster, s->base_zero_map) ||
+               !privmem_drop_pages(s->buf + offset, bytes)) {
+        memset(s->buf + offset, 0, bytes);
+    }
+    set_bit(cluster, s->zero_map);
+    set_bit(cluster, s->dirty_map);
+}
+
+/* Write @bytes at @offset from @qiov, or zeroes if @qiov is NULL */
+static int coroutine_fn privmem_do_write(BlockDriverState *bs, uint64_t offset,
+                                         uint64_t bytes, QEMUIOVector *qiov)
+{
+    BDRVCOWState *s = bs->opaque;
+    uint64_t qiov_offset = 0;
+    int ret = 0;
+
+    ret = privmem_check_request(s, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    s->stats.write_bytes += bytes;
+    while (bytes) {
+        uint64_t cluster = offset / s->cluster_size;
+        uint64_t cluster_bytes = privmem_cluster_bytes(s, cluster);
+        uint64_t n = MIN(bytes, (cluster + 1) * s->cluster_size - offset);
+        bool is_zero = !qiov || privmem_iov_is_zero(qiov, qiov_offset, n);
+        char *mem;
+
+        privmem_scan_cluster(s, cluster);
+        if (is_zero && test_bit(cluster, s->zero_map)) {
+            s->stats.zero_write_bytes += n;
+        } else if (is_zero && n == cluster_bytes) {
+            privmem_save_fork_cluster(s, cluster);
+            privmem_zero_cluster(s, cluster);
+        } else {
+            privmem_save_fork_cluster(s, cluster);
+            if (s->overlay && !privmem_in_overlay(s, cluster) &&
+                n != cluster_bytes) {
+                ret = privmem_copy_up(bs, cluster);
+                if (ret < 0) {
+                    break;
+                }
+            }
+            mem = s->overlay ? s->overlay : s->buf;
+            if (qiov) {
+                qemu_iovec_to_buf(qiov, qiov_offset, mem + offset, n);
+            } else {
+                memset(mem + offset, 0, n);
+            }
+            clear_bit(cluster, s->zero_map);
+            set_bit(cluster, s->dirty_map);
+        }
+        offset += n;
+        qiov_offset += n;
+        bytes -= n;
+    }
+    qemu_co_mutex_unlock(&s->lock);
+    return ret;
 }
 
 static coroutine_fn int privmem_write(BlockDriverState *bs, uint64_t offset,
                                       uint64_t bytes, QEMUIOVector *qiov,
                                       int flags)
+{
+    return privmem_do_write(bs, offset, bytes, qiov);
+}
+
+static coroutine_fn int privmem_pwrite_zeroes(BlockDriverState *bs,
+                                              int64_t offset, int bytes,
+                                              BdrvRequestFlags flags)
+{
+    return privmem_do_write(bs, offset, bytes, NULL);
+}
+
+static int coroutine_fn privmem_co_block_status(BlockDriverState *bs,
+                                                bool want_zero, int64_t offset,
+                                                int64_t bytes, int64_t *pnum,
+                                                int64_t *map,
+                                                BlockDriverState **file)
 {
     BDRVCOWState *s = bs->opaque;
-    return qemu_iovec_to_buf(qiov,0,s->buf+offset, bytes);
+    uint64_t n;
+    int kind;
+
+    kind = privmem_run(s, offset, bytes, &n);
+    *pnum = n;
+    return kind == PRIVMEM_ZERO ? BDRV_BLOCK_ZERO : BDRV_BLOCK_DATA;
+}
+
+/* Bring clusters [@start, @end) back to the contents of the backing image */
+static int privmem_reset_extent(BDRVCOWState *s, uint64_t start, uint64_t end)
+{
+    uint64_t offset = start * s->cluster_size;
+    uint64_t bytes = MIN(end * s->cluster_size, s->size) - offset;
+
+    if (s->overlay) {
+        if (!privmem_drop_pages(s->overlay + offset,
+                                (end - start) * s->cluster_size)) {
+            memset(s->overlay + offset, 0, bytes);
+        }
+    } else if (!privmem_drop_pages(s->buf + offset, bytes)) {
+        if (pread(s->fd, s->buf + offset, bytes, offset) != bytes) {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+/* Bring a cluster written before the fork back to its state at fork */
+static void privmem_reset_fork_cluster(BDRVCOWState *s, uint64_t cluster)
+{
+    uint64_t offset = cluster * s->cluster_size;
+    uint64_t bytes = privmem_cluster_bytes(s, cluster);
+    char *saved = g_hash_table_lookup(s->fork_saved,
+                                      GSIZE_TO_POINTER(cluster));
+
+    if (saved) {
+        memcpy((s->overlay ? s->overlay : s->buf) + offset, saved, bytes);
+    } else {
+        /* It was zero at fork */
+        privmem_zero_cluster(s, cluster);
+    }
+}
+
+/* Throw away everything written since open, the last fork or the last
+ * reset.  Only the dirty extents are touched, and on Linux the private
+ * pages are dropped rather than copied back, except for the clusters that
+ * were already written before the fork.
+ */
+static int privmem_make_empty(BlockDriverState *bs)
+{
+    BDRVCOWState *s = bs->opaque;
+    uint64_t start, end, dirty = 0;
+    uint64_t cluster, next;
+    int ret;
+
+    for (start = find_first_bit(s->dirty_map, s->nb_clusters);
+         start < s->nb_clusters;
+         start = find_next_bit(s->dirty_map, s->nb_clusters, end)) {
+        end = find_next_zero_bit(s->dirty_map, s->nb_clusters, start);
+
+        for (cluster = start; cluster < end; cluster = next) {
+            next = find_next_bit(s->fork_map, end, cluster);
+            if (next == cluster) {
+                privmem_reset_fork_cluster(s, cluster);
+                next++;
+                continue;
+            }
+            ret = privmem_reset_extent(s, cluster, next);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+
+        for (cluster = start; cluster < end; cluster++) {
+            if (test_bit(cluster, s->reset_zero_map)) {
+                set_bit(cluster, s->zero_map);
+            } else {
+                clear_bit(cluster, s->zero_map);
+            }
+        }
+        bitmap_clear(s->dirty_map, start, end - start);
+        dirty += end - start;
+    }
+
+    s->stats.resets++;
+    trace_privmem_make_empty(bs, dirty);
+    return 0;
+}
+
+/* The state inherited from the fork server parent, including what it
+ * wrote, becomes what bdrv_make_empty() goes back to in this child.
+ */
+static void privmem_fork_child(BlockDriverState *bs)
+{
+    BDRVCOWState *s = bs->opaque;
+
+    bitmap_or(s->fork_map, s->fork_map, s->dirty_map, s->nb_clusters);
+    bitmap_zero(s->dirty_map, s->nb_clusters);
+    bitmap_copy(s->reset_zero_map, s->zero_map, s->nb_clusters);
+    g_hash_table_remove_all(s->fork_saved);
+}
+
+static BlockStatsSpecific *privmem_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVCOWState *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_PRIVMEM;
+    stats->u.privmem = (BlockStatsSpecificPrivmem) {
+        .read_bytes = s->stats.read_bytes,
+        .write_bytes = s->stats.write_bytes,
+        .zero_read_bytes = s->stats.zero_read_bytes,
+        .zero_write_bytes = s->stats.zero_write_bytes,
+        .copy_ups = s->stats.copy_ups,
+        .resets = s->stats.resets,
+        .dirty_clusters = bitmap_count_one(s->dirty_map, s->nb_clusters),
+        .zero_clusters = bitmap_count_one(s->zero_map, s->nb_clusters),
+        .clusters = s->nb_clusters,
+    };
+    return stats;
 }
 
 static BlockDriver bdrv_privmem = {
@@ -139,9 +812,15 @@ static BlockDriver bdrv_privmem = {
     .bdrv_file_open         = privmem_file_open,
     .bdrv_close             = privmem_close,
     .bdrv_getlength         = privmem_getlength,
+    .bdrv_child_perm        = privmem_child_perm,
+    .bdrv_make_empty        = privmem_make_empty,
+    .bdrv_fork_child        = privmem_fork_child,
+    .bdrv_get_specific_stats = privmem_get_specific_stats,
 
     .bdrv_co_preadv          = privmem_read,
     .bdrv_co_pwritev         = privmem_write,
+    .bdrv_co_pwrite_zeroes   = privmem_pwrite_zeroes,
+    .bdrv_co_block_status    = privmem_co_block_status,
 };
 
 static void bdrv_privmem_init(void)
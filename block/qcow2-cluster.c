@@ -218,6 +218,21 @@ static int l2_load(BlockDriverState *bs, uint64_t offset,
                            (void **)l2_slice);
 }
 
+/*
+ * Returns the cached l2 slice for @offset without taking a reference, or
+ * NULL if it is not cached.  The result is only valid until the next yield.
+ */
+static uint64_t *l2_lookup(BlockDriverState *bs, uint64_t offset,
+                           uint64_t l2_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int start_of_slice = sizeof(uint64_t) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+
+    return qcow2_cache_is_table_offset(s->l2_table_cache,
+                                       l2_offset + start_of_slice);
+}
+
 /*
  * Writes one sector of the L1 table to the disk (can't update single entries
  * and we really don't want bdrv_pread to perform a read-modify-write)
@@ -524,9 +539,15 @@ static int coroutine_fn do_perform_cow_write(BlockDriverState *bs,
  *
  * Returns the cluster type (QCOW2_CLUSTER_*) on success, -errno in error
  * cases.
+ *
+ * With @cached_only, nothing is read from disk and nothing can yield: if the
+ * L2 slice is not in the cache, or the metadata looks corrupted, -EAGAIN is
+ * returned and the caller should retry through the locked path, which also
+ * takes care of reporting the corruption.
  */
-int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
-                             unsigned int *bytes, uint64_t *cluster_offset)
+static int get_cluster_offset(BlockDriverState *bs, uint64_t offset,
+                              unsigned int *bytes, uint64_t *cluster_offset,
+                              bool cached_only)
 {
     BDRVQcow2State *s = bs->opaque;
     unsigned int l2_index;
@@ -568,6 +589,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
     }
 
     if (offset_into_cluster(s, l2_offset)) {
+        if (cached_only) {
+            return -EAGAIN;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#" PRIx64
                                 " unaligned (L1 index: %#" PRIx64 ")",
                                 l2_offset, l1_index);
@@ -576,9 +600,16 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
 
     /* load the l2 slice in memory */
 
-    ret = l2_load(bs, offset, l2_offset, &l2_slice);
-    if (ret < 0) {
-        return ret;
+    if (cached_only) {
+        l2_slice = l2_lookup(bs, offset, l2_offset);
+        if (!l2_slice) {
+            return -EAGAIN;
+        }
+    } else {
+        ret = l2_load(bs, offset, l2_offset, &l2_slice);
+        if (ret < 0) {
+            return ret;
+        }
     }
 
     /* find the cluster offset for the given disk offset */
@@ -595,6 +626,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
     type = qcow2_get_cluster_type(*cluster_offset);
     if (s->qcow_version < 3 && (type == QCOW2_CLUSTER_ZERO_PLAIN ||
                                 type == QCOW2_CLUSTER_ZERO_ALLOC)) {
+        if (cached_only) {
+            return -EAGAIN;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "Zero cluster entry found"
                                 " in pre-v3 image (L2 offset: %#" PRIx64
                                 ", L2 index: %#x)", l2_offset, l2_index);
@@ -621,6 +655,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
                                       &l2_slice[l2_index], QCOW_OFLAG_ZERO);
         *cluster_offset &= L2E_OFFSET_MASK;
         if (offset_into_cluster(s, *cluster_offset)) {
+            if (cached_only) {
+                return -EAGAIN;
+            }
             qcow2_signal_corruption(bs, true, -1, -1,
                                     "Cluster allocation offset %#"
                                     PRIx64 " unaligned (L2 offset: %#" PRIx64
@@ -634,7 +671,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
         abort();
     }
 
-    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    if (!cached_only) {
+        qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    }
 
     bytes_available = (int64_t)c * s->cluster_size;
 
@@ -656,6 +695,24 @@ fail:
     return ret;
 }
 
+int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
+                             unsigned int *bytes, uint64_t *cluster_offset)
+{
+    return get_cluster_offset(bs, offset, bytes, cluster_offset, false);
+}
+
+/*
+ * Like qcow2_get_cluster_offset(), but only consults L2 slices that are
+ * already cached.  This never yields, so it can be called without s->lock
+ * from the read path; on -EAGAIN fall back to qcow2_get_cluster_offset().
+ */
+int qcow2_get_cluster_offset_cached(BlockDriverState *bs, uint64_t offset,
+                                    unsigned int *bytes,
+                                    uint64_t *cluster_offset)
+{
+    return get_cluster_offset(bs, offset, bytes, cluster_offset, true);
+}
+
 /*
  * get_cluster_table
  *
@@ -719,6 +719,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_FAST_RESET,
+            .type = QEMU_OPT_BOOL,
+            .help = "Track written clusters so that emptying the image only "
+                    "has to touch those",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -862,6 +868,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    bool fast_reset;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -968,6 +975,9 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->fast_reset = qemu_opt_get_bool(opts, QCOW2_OPT_FAST_RESET,
+                                      s->reset_bitmap != NULL);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1089,6 +1099,20 @@ fail:
     return ret;
 }
 
+/* Returns true if nothing at all is allocated in the active L1 table */
+static bool qcow2_is_empty(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < s->l1_size; i++) {
+        if (s->l1_table[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void qcow2_update_options_commit(BlockDriverState *bs,
                                         Qcow2ReopenState *r)
 {
@@ -1118,6 +1142,17 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    if (r->fast_reset && !s->reset_bitmap) {
+        /* The written areas only describe everything allocated in the
+         * active layer if tracking starts out from an empty image */
+        s->reset_bitmap = bdrv_create_dirty_bitmap(bs, s->cluster_size,
+                                                   NULL, NULL);
+        s->reset_bitmap_complete = qcow2_is_empty(bs);
+    } else if (!r->fast_reset && s->reset_bitmap) {
+        bdrv_release_dirty_bitmap(bs, s->reset_bitmap);
+        s->reset_bitmap = NULL;
+    }
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1875,8 +1910,6 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
-    qemu_co_mutex_lock(&s->lock);
-
     while (bytes != 0) {
 
         /* prepare next request */
@@ -1886,7 +1919,19 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        ret = qcow2_get_cluster_offset(bs, offset, &cur_bytes, &cluster_offset);
+        /*
+         * Metadata lookups that hit the L2 cache never yield, so they need
+         * not wait for s->lock; only a cache miss goes through the lock.
+         * Nothing below touches metadata.
+         */
+        ret = qcow2_get_cluster_offset_cached(bs, offset, &cur_bytes,
+                                              &cluster_offset);
+        if (ret == -EAGAIN) {
+            qemu_co_mutex_lock(&s->lock);
+            ret = qcow2_get_cluster_offset(bs, offset, &cur_bytes,
+                                           &cluster_offset);
+            qemu_co_mutex_unlock(&s->lock);
+        }
         if (ret < 0) {
             goto fail;
         }
@@ -1901,10 +1946,8 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
 
             if (bs->backing) {
                 BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
-                qemu_co_mutex_unlock(&s->lock);
                 ret = bdrv_co_preadv(bs->backing, offset, cur_bytes,
                                      &hd_qiov, 0);
-                qemu_co_mutex_lock(&s->lock);
                 if (ret < 0) {
                     goto fail;
                 }
@@ -1920,11 +1963,9 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             break;
 
         case QCOW2_CLUSTER_COMPRESSED:
-            qemu_co_mutex_unlock(&s->lock);
             ret = qcow2_co_preadv_compressed(bs, cluster_offset,
                                              offset, cur_bytes,
                                              &hd_qiov);
-            qemu_co_mutex_lock(&s->lock);
             if (ret < 0) {
                 goto fail;
             }
@@ -1961,11 +2002,9 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             }
 
             BLKDBG_EVENT(bs->file, BLKDBG_READ_AIO);
-            qemu_co_mutex_unlock(&s->lock);
             ret = bdrv_co_preadv(bs->file,
                                  cluster_offset + offset_in_cluster,
                                  cur_bytes, &hd_qiov, 0);
-            qemu_co_mutex_lock(&s->lock);
             if (ret < 0) {
                 goto fail;
             }
@@ -2000,8 +2039,6 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
     ret = 0;
 
 fail:
-    qemu_co_mutex_unlock(&s->lock);
-
     qemu_iovec_destroy(&hd_qiov);
     qemu_vfree(cluster_data);
 
@@ -2218,6 +2255,11 @@ static void qcow2_close(BlockDriverState *bs)
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
 
+    if (s->reset_bitmap) {
+        bdrv_release_dirty_bitmap(bs, s->reset_bitmap);
+        s->reset_bitmap = NULL;
+    }
+
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
 
@@ -3486,6 +3528,11 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
 
     qemu_co_mutex_lock(&s->lock);
 
+    if (prealloc != PREALLOC_MODE_OFF) {
+        /* Preallocated clusters are allocated without being written */
+        s->reset_bitmap_complete = false;
+    }
+
     /* cannot proceed if image has snapshots */
     if (s->nb_snapshots) {
         error_setg(errp, "Can't resize an image which has snapshots");
@@ -4178,6 +4225,18 @@ fail:
     return ret;
 }
 
+static void qcow2_copy_on_read_written(BlockDriverState *bs,
+                                       int64_t offset, int64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    /* Copied clusters are allocated in this image, so a reset must drop them
+     * like anything the guest wrote */
+    if (s->reset_bitmap) {
+        bdrv_set_dirty_bitmap(s->reset_bitmap, offset, bytes);
+    }
+}
+
 static int qcow2_make_empty(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -4187,6 +4246,35 @@ static int qcow2_make_empty(BlockDriverState *bs)
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / sizeof(uint64_t));
 
+    end_offset = bs->total_sectors * BDRV_SECTOR_SIZE;
+
+    if (s->reset_bitmap && s->reset_bitmap_complete) {
+        /* Only what was written since the image was last empty can be
+         * allocated, so discarding that is enough.  The bitmap is reset
+         * piecewise so that it stays complete if a discard fails. */
+        uint64_t bytes = end_offset;
+        uint64_t dropped = 0;
+
+        offset = 0;
+        while (offset < end_offset &&
+               bdrv_dirty_bitmap_next_dirty_area(s->reset_bitmap,
+                                                 &offset, &bytes)) {
+            bytes = MIN(bytes, step);
+            ret = qcow2_cluster_discard(bs, offset, bytes,
+                                        QCOW2_DISCARD_SNAPSHOT, true);
+            if (ret < 0) {
+                return ret;
+            }
+            bdrv_reset_dirty_bitmap(s->reset_bitmap, offset, bytes);
+            dropped += bytes;
+
+            offset += bytes;
+            bytes = end_offset - offset;
+        }
+        trace_qcow2_make_empty_fast(bs, dropped);
+        return 0;
+    }
+
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size &&
         s->crypt_method_header != QCOW_CRYPT_LUKS) {
@@ -4197,23 +4285,29 @@ static int qcow2_make_empty(BlockDriverState *bs)
          * empties the image.  Furthermore, the L1 table and three
          * additional clusters (image header, refcount table, one
          * refcount block) have to fit inside one refcount block. */
-        return make_completely_empty(bs);
+        ret = make_completely_empty(bs);
+    } else {
+        /* This fallback code simply discards every active cluster; this is
+         * slow, but works in all cases */
+        for (offset = 0; offset < end_offset; offset += step) {
+            /* As this function is generally used after committing an
+             * external snapshot, QCOW2_DISCARD_SNAPSHOT seems appropriate.
+             * Also, the default action for this kind of discard is to pass
+             * the discard, which will ideally result in an actually smaller
+             * image file, as is probably desired. */
+            ret = qcow2_cluster_discard(bs, offset,
+                                        MIN(step, end_offset - offset),
+                                        QCOW2_DISCARD_SNAPSHOT, true);
+            if (ret < 0) {
+                break;
+            }
+        }
     }
 
-    /* This fallback code simply discards every active cluster; this is slow,
-     * but works in all cases */
-    end_offset = bs->total_sectors * BDRV_SECTOR_SIZE;
-    for (offset = 0; offset < end_offset; offset += step) {
-        /* As this function is generally used after committing an external
-         * snapshot, QCOW2_DISCARD_SNAPSHOT seems appropriate. Also, the
-         * default action for this kind of discard is to pass the discard,
-         * which will ideally result in an actually smaller image file, as
-         * is probably desired. */
-        ret = qcow2_cluster_discard(bs, offset, MIN(step, end_offset - offset),
-                                    QCOW2_DISCARD_SNAPSHOT, true);
-        if (ret < 0) {
-            break;
-        }
+    if (ret == 0 && s->reset_bitmap) {
+        /* From now on the next reset can take the fast path */
+        bdrv_clear_dirty_bitmap(s->reset_bitmap, NULL);
+        s->reset_bitmap_complete = true;
     }
 
     return ret;
@@ -4605,6 +4699,9 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     QemuOptDesc *desc = opts->list->desc;
     Qcow2AmendHelperCBInfo helper_cb_info;
 
+    /* Amending may rewrite clusters, so be conservative about fast resets */
+    s->reset_bitmap_complete = false;
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
@@ -4943,6 +5040,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_co_truncate       = qcow2_co_truncate,
     .bdrv_co_pwritev_compressed = qcow2_co_pwritev_compressed,
     .bdrv_make_empty        = qcow2_make_empty,
+    .bdrv_copy_on_read_written = qcow2_copy_on_read_written,
 
     .bdrv_snapshot_create   = qcow2_snapshot_create,
     .bdrv_snapshot_goto     = qcow2_snapshot_goto,
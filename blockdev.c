@@ -385,6 +385,10 @@ static void extract_common_blockdev_options(QemuOpts *opts, int *bdrv_flags,
         if ((aio = qemu_opt_get(opts, "aio")) != NULL) {
             if (!strcmp(aio, "native")) {
                 *bdrv_flags |= BDRV_O_NATIVE_AIO;
+#ifdef CONFIG_LINUX_IO_URING
+            } else if (!strcmp(aio, "io_uring")) {
+                *bdrv_flags |= BDRV_O_IO_URING;
+#endif
             } else if (!strcmp(aio, "threads")) {
                 /* this is the default */
             } else {
@@ -1106,6 +1110,47 @@ void hmp_commit(Monitor *mon, const QDict *qdict)
     }
 }
 
+void qmp_blockdev_reset_overlay(const char *node_name, Error **errp)
+{
+    BlockDriverState *bs;
+    AioContext *aio_context;
+
+    bs = bdrv_find_node(node_name);
+    if (!bs) {
+        error_setg(errp, "Cannot find node %s", node_name);
+        return;
+    }
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+
+    bdrv_make_empty(bs, errp);
+
+    aio_context_release(aio_context);
+}
+
+void hmp_reset_overlay(Monitor *mon, const QDict *qdict)
+{
+    const char *device = qdict_get_str(qdict, "device");
+    BlockBackend *blk;
+    Error *local_err = NULL;
+
+    /* Accept a node name as well as a device name */
+    blk = blk_by_name(device);
+    if (blk) {
+        if (!blk_is_available(blk)) {
+            monitor_printf(mon, "Device '%s' has no medium\n", device);
+            return;
+        }
+        device = bdrv_get_node_name(blk_bs(blk));
+    }
+
+    qmp_blockdev_reset_overlay(device, &local_err);
+    if (local_err) {
+        error_report_err(local_err);
+    }
+}
+
 static void blockdev_do_action(TransactionAction *action, Error **errp)
 {
     TransactionActionList list;
@@ -4490,7 +4535,7 @@ QemuOptsList qemu_common_drive_opts = {
         },{
             .name = "aio",
             .type = QEMU_OPT_STRING,
-            .help = "host AIO implementation (threads, native)",
+            .help = "host AIO implementation (threads, native, io_uring)",
         },{
             .name = BDRV_OPT_CACHE_WB,
             .type = QEMU_OPT_BOOL,
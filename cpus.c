@@ -41,6 +41,7 @@
 #include "sysemu/hvf.h"
 #include "sysemu/whpx.h"
 #include "exec/exec-all.h"
+#include "exec/ram_addr.h"
 
 #include "qemu/thread.h"
 #include "sysemu/cpus.h"
@@ -92,7 +93,7 @@ bool cpu_is_stopped(CPUState *cpu)
 
 static bool cpu_thread_is_idle(CPUState *cpu)
 {
-    if (cpu->stop || cpu->queued_work_first) {
+    if (cpu->stop || cpu->queued_work_first || afl_wants_cpu_to_stop) {
         return false;
     }
     if (cpu_is_stopped(cpu)) {
@@ -159,6 +160,7 @@ typedef struct TimersState {
 
 static TimersState timers_state;
 bool mttcg_enabled;
+uint32_t tcg_dirty_ring_size;
 
 /*
  * We default to false if we know other options have been enabled
@@ -231,6 +233,16 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+    tcg_dirty_ring_size = qemu_opt_get_number(opts, "dirty-ring-size", 0);
+    if (tcg_dirty_ring_size) {
+        if (!is_power_of_2(tcg_dirty_ring_size)) {
+            error_setg(errp, "dirty-ring-size must be a power of 2");
+            tcg_dirty_ring_size = 0;
+            return;
+        }
+        cpu_physical_memory_dirty_ring_init();
+    }
 }
 
 /* The current number of executed instructions is based on what we
@@ -569,12 +581,44 @@ void qtest_clock_warp(int64_t dest)
     qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
 }
 
+/* With -aflIdleWarp and no icount, QEMU_CLOCK_VIRTUAL is jumped straight
+ * to the next timer deadline as soon as every vCPU is idle (H_CEDE, nap,
+ * ...), like icount's no-sleep warp does.  A guest that sleeps on a timer
+ * then costs no wall-clock time, and running code pays nothing for it.
+ */
+static void qemu_idle_warp_clock(void)
+{
+    int64_t deadline;
+
+    if (!aflIdleWarp || !runstate_is_running() || qtest_enabled()) {
+        return;
+    }
+    if (!all_cpu_threads_idle()) {
+        return;
+    }
+
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL);
+    if (deadline < 0) {
+        /* No timer pending: nothing to skip to */
+        return;
+    }
+    if (deadline > 0) {
+        seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                           &timers_state.vm_clock_lock);
+        timers_state.cpu_clock_offset += deadline;
+        seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                             &timers_state.vm_clock_lock);
+    }
+    qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+}
+
 void qemu_start_warp_timer(void)
 {
     int64_t clock;
     int64_t deadline;
 
     if (!use_icount) {
+        qemu_idle_warp_clock();
         return;
     }
 
@@ -1571,7 +1615,7 @@ static void *qemu_tcg_rr_cpu_thread_fn(void *arg)
             atomic_mb_set(&cpu->exit_request, 0);
         }
 
-        if (use_icount && all_cpu_threads_idle()) {
+        if ((use_icount || aflIdleWarp) && all_cpu_threads_idle()) {
             /*
              * When all cpus are sleeping (e.g in WFI), to avoid a deadlock
              * in the main_loop, wake it up in order to start the warp timer.
@@ -1739,6 +1783,34 @@ static void CALLBACK dummy_apc_func(ULONG_PTR unused)
  * current CPUState for a given thread.
  */
 
+/* Number of MTTCG vCPU threads that have not yet stopped for the AFL
+ * forkserver.  Protected by the BQL.
+ */
+static int afl_tcg_threads_running;
+
+/* Called by each MTTCG vCPU thread as it leaves its loop on
+ * afl_wants_cpu_to_stop; the last one out hands over to the iothread,
+ * exactly as the round-robin thread does when it stops.
+ */
+static void afl_tcg_thread_stopped(void)
+{
+    if (--afl_tcg_threads_running > 0) {
+        return;
+    }
+
+    printf("AFL stopping CPU threads\n");
+    fflush(stdout);
+    /* tell iothread to run AFL forkserver */
+    afl_wants_cpu_to_stop = 0;
+    if (write(afl_qemuloop_pipe[1], "FORK", 4) != 4) {
+        perror("write afl_qemuloop_pip");
+    }
+    afl_qemuloop_pipe[1] = -1;
+
+    restart_cpu = first_cpu;
+    cpu_disable_ticks();
+}
+
 static void *qemu_tcg_cpu_thread_fn(void *arg)
 {
     CPUState *cpu = arg;
@@ -1756,6 +1828,7 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     cpu->created = true;
     cpu->can_do_io = 1;
     current_cpu = cpu;
+    afl_tcg_threads_running++;
     qemu_cond_signal(&qemu_cpu_cond);
 
     /* process any pending work */
@@ -1792,8 +1865,19 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
         }
 
         atomic_mb_set(&cpu->exit_request, 0);
+        if (aflIdleWarp && all_cpu_threads_idle()) {
+            /* let the main loop skip the clock to the next deadline */
+            qemu_notify_event();
+        }
         qemu_wait_io_event(cpu);
-    } while (!cpu->unplug || cpu_can_run(cpu));
+    } while ((!cpu->unplug || cpu_can_run(cpu)) && !afl_wants_cpu_to_stop);
+
+    if (afl_wants_cpu_to_stop) {
+        afl_tcg_thread_stopped();
+        qemu_mutex_unlock_iothread();
+        rcu_unregister_thread();
+        return NULL;
+    }
 
     qemu_tcg_destroy_vcpu(cpu);
     cpu->created = false;
@@ -2531,6 +2615,9 @@ gotPipeNotification(void *ctx)
     //env = restart_cpu->env_ptr;
 
 //  tb_flush(first_cpu);
+    /* the children can't complete requests that the parent started */
+    bdrv_drain_all();
+    replay_fork_prepare();
     if(afl_attached())
     {
         afl_forkserver(env);
@@ -2542,11 +2629,23 @@ gotPipeNotification(void *ctx)
     }
 
     /* we're now in the child! */
+    bdrv_fork_child();
+    replay_fork_start();
     if(aflEnableTicks) // re-enable ticks only if asked to
         cpu_enable_ticks();
 
     reboot_thread = true;
-    qemu_tcg_init_vcpu(first_cpu);
+    if (qemu_tcg_mttcg_enabled()) {
+        CPUState *cpu;
+
+        /* every vCPU thread stopped in the parent; restart them all */
+        tcg_reclaim_thread_contexts();
+        CPU_FOREACH(cpu) {
+            qemu_tcg_init_vcpu(cpu);
+        }
+    } else {
+        qemu_tcg_init_vcpu(first_cpu);
+    }
     reboot_thread = false;
 
 
@@ -926,6 +926,11 @@ void cpu_exec_unrealizefn(CPUState *cpu)
     }
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_free_notifier_list(cpu);
+    g_free(cpu->mmio_dispatch);
+    cpu->mmio_dispatch = NULL;
+    if (cpu->dirty_ring) {
+        cpu_physical_memory_dirty_ring_remove_cpu(cpu);
+    }
 #endif
 }
 
@@ -977,6 +982,9 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
     }
 
     cpu->iommu_notifiers = g_array_new(false, true, sizeof(TCGIOMMUNotifier));
+    if (tcg_enabled() && tcg_dirty_ring_size) {
+        cpu_physical_memory_dirty_ring_add_cpu(cpu);
+    }
 #endif
 }
 
@@ -1340,6 +1348,153 @@ static void tlb_reset_dirty_range_all(ram_addr_t start, ram_addr_t length)
     rcu_read_unlock();
 }
 
+/* Dirty page rings
+ *
+ * With -accel tcg,dirty-ring-size=N each vCPU queues the pages it dirties
+ * for the migration client in a ring of N entries, so that the consumer
+ * visits only the pages that were written instead of scanning the whole
+ * DIRTY_MEMORY_MIGRATION bitmap.  Pages dirtied outside of a vCPU thread
+ * (DMA, RAM block setup) go to a shared ring.  A page is queued only when
+ * its bit goes from clean to dirty.  When a ring is full the page stays
+ * in the bitmap only and dirty_ring_overflow tells the consumer to fall
+ * back to a full scan.
+ */
+struct DirtyRing {
+    struct rcu_head rcu;
+    uint32_t size;
+    uint32_t head;              /* written by the producer */
+    uint32_t tail;              /* written by the consumer */
+    ram_addr_t pages[];
+};
+
+static DirtyRing *shared_dirty_ring;
+static QemuSpin shared_dirty_ring_lock;
+static bool dirty_ring_overflow;
+
+static DirtyRing *dirty_ring_new(uint32_t size)
+{
+    DirtyRing *ring = g_malloc0(sizeof(*ring) + size * sizeof(ram_addr_t));
+
+    ring->size = size;
+    return ring;
+}
+
+void cpu_physical_memory_dirty_ring_init(void)
+{
+    assert(is_power_of_2(tcg_dirty_ring_size));
+    qemu_spin_init(&shared_dirty_ring_lock);
+    shared_dirty_ring = dirty_ring_new(tcg_dirty_ring_size);
+    /* Pages dirtied so far are only in the bitmap */
+    atomic_set(&dirty_ring_overflow, true);
+}
+
+void cpu_physical_memory_dirty_ring_add_cpu(CPUState *cpu)
+{
+    cpu->dirty_ring = dirty_ring_new(tcg_dirty_ring_size);
+}
+
+void cpu_physical_memory_dirty_ring_remove_cpu(CPUState *cpu)
+{
+    DirtyRing *ring = cpu->dirty_ring;
+
+    /* The pages still queued are lost, as far as the consumer knows */
+    atomic_set(&dirty_ring_overflow, true);
+    atomic_set(&cpu->dirty_ring, NULL);
+    g_free_rcu(ring, rcu);
+}
+
+/* Set @nr bits of @bitmap starting at @offset, which correspond to the pages
+ * starting at @page, and queue the pages that were clean.
+ */
+void cpu_physical_memory_dirty_ring_set(unsigned long *bitmap,
+                                        unsigned long offset,
+                                        unsigned long page,
+                                        unsigned long nr)
+{
+    DirtyRing *ring = current_cpu ? current_cpu->dirty_ring : NULL;
+    bool shared = !ring;
+    uint32_t head;
+    unsigned long i;
+
+    if (shared) {
+        ring = shared_dirty_ring;
+        qemu_spin_lock(&shared_dirty_ring_lock);
+    }
+
+    head = ring->head;
+    if (nr > ring->size - (head - atomic_load_acquire(&ring->tail))) {
+        /* Would not fit anyway, e.g. a whole RAM block being dirtied */
+        bitmap_set_atomic(bitmap, offset, nr);
+        atomic_set(&dirty_ring_overflow, true);
+        goto out;
+    }
+
+    for (i = 0; i < nr; i++) {
+        unsigned long bit = offset + i;
+        unsigned long mask = BIT_MASK(bit);
+
+        if (!(atomic_read(&bitmap[BIT_WORD(bit)]) & mask) &&
+            !(atomic_fetch_or(&bitmap[BIT_WORD(bit)], mask) & mask)) {
+            ring->pages[head & (ring->size - 1)] = page + i;
+            head++;
+        }
+    }
+    atomic_store_release(&ring->head, head);
+
+out:
+    if (shared) {
+        qemu_spin_unlock(&shared_dirty_ring_lock);
+    }
+}
+
+static void dirty_ring_collect(DirtyRing *ring, DirtyRingFunc *fn,
+                               void *opaque)
+{
+    uint32_t head = atomic_load_acquire(&ring->head);
+    uint32_t tail = ring->tail;
+
+    if (fn) {
+        trace_dirty_ring_collect(head - tail);
+        for (; tail != head; tail++) {
+            fn(ring->pages[tail & (ring->size - 1)] << TARGET_PAGE_BITS,
+               opaque);
+        }
+    }
+    atomic_store_release(&ring->tail, head);
+}
+
+/* Call @fn for the address of every page queued in the dirty rings since the
+ * last call, and empty the rings.  Returns false without calling @fn if some
+ * pages could not be queued; the caller must then scan the whole
+ * DIRTY_MEMORY_MIGRATION bitmap instead.  Pages can be reported more than
+ * once, and pages whose bit was cleared in the meantime are reported too.
+ *
+ * Must be called by a single consumer at a time.
+ */
+bool cpu_physical_memory_dirty_ring_collect(DirtyRingFunc *fn, void *opaque)
+{
+    bool overflow = atomic_xchg(&dirty_ring_overflow, false);
+    CPUState *cpu;
+
+    if (overflow) {
+        trace_dirty_ring_overflow();
+        fn = NULL;
+    }
+
+    rcu_read_lock();
+    CPU_FOREACH(cpu) {
+        DirtyRing *ring = atomic_rcu_read(&cpu->dirty_ring);
+
+        if (ring) {
+            dirty_ring_collect(ring, fn, opaque);
+        }
+    }
+    rcu_read_unlock();
+    dirty_ring_collect(shared_dirty_ring, fn, opaque);
+
+    return !overflow;
+}
+
 /* Note: start and end must be within the same ram block.  */
 bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
                                               ram_addr_t length,
@@ -2070,6 +2225,19 @@ static int memory_try_enable_merging(void *addr, size_t len)
     return qemu_madvise(addr, len, QEMU_MADV_MERGEABLE);
 }
 
+/*
+ * Apply again the madvise() settings that guest RAM gets when it is
+ * allocated, to a part of a RAM block that was replaced by a new mapping.
+ */
+void qemu_ram_remap_advise(void *addr, ram_addr_t length)
+{
+    memory_try_enable_merging(addr, length);
+    qemu_ram_setup_dump(addr, length);
+    qemu_madvise(addr, length,
+                 machine_mem_hugepages(current_machine) ?
+                 QEMU_MADV_HUGEPAGE : QEMU_MADV_NOHUGEPAGE);
+}
+
 /* Only legal before guest might have detected the memory size: e.g. on
  * incoming migration, or right after reset.
  *
@@ -2225,7 +2393,9 @@ static void ram_block_add(RAMBlock *new_block, Error **errp, bool shared)
 
     if (new_block->host) {
         qemu_ram_setup_dump(new_block->host, new_block->max_length);
-        qemu_madvise(new_block->host, new_block->max_length, QEMU_MADV_HUGEPAGE);
+        qemu_madvise(new_block->host, new_block->max_length,
+                     machine_mem_hugepages(current_machine) ?
+                     QEMU_MADV_HUGEPAGE : QEMU_MADV_NOHUGEPAGE);
         /* MADV_DONTFORK is also needed by KVM in absence of synchronous MMU */
         // but we can't allow setting that if we actually want to fork~
       //  qemu_madvise(new_block->host, new_block->max_length, QEMU_MADV_DONTFORK);
@@ -3784,6 +3954,89 @@ void address_space_cache_destroy(MemoryRegionCache *cache)
     cache->fv = NULL;
 }
 
+hwaddr address_space_pin(AddressSpacePin *pin, AddressSpace *as, hwaddr addr,
+                         hwaddr len, bool is_write, MemTxAttrs attrs)
+{
+    hwaddr l = len;
+    MemoryRegion *mr;
+
+    assert(len > 0);
+
+    memset(pin, 0, sizeof(*pin));
+    pin->as = as;
+    pin->addr = addr;
+    pin->attrs = attrs;
+    pin->is_write = is_write;
+    pin->fv = address_space_get_flatview(as);
+
+    rcu_read_lock();
+    mr = flatview_translate(pin->fv, addr, &pin->xlat, &l, is_write, attrs);
+    if (memory_access_is_direct(mr, is_write) && !xen_enabled()) {
+        memory_region_ref(mr);
+        pin->mr = mr;
+        l = flatview_extend_translation(pin->fv, addr, len, mr, pin->xlat,
+                                        l, is_write, attrs);
+        pin->ptr = qemu_ram_ptr_length(mr->ram_block, pin->xlat, &l, true);
+        pin->len = l;
+    }
+    rcu_read_unlock();
+
+    trace_address_space_pin(as, addr, len, pin->len);
+    return pin->len;
+}
+
+/* Whether [@addr, @addr + @len) can be accessed through @pin->ptr */
+static inline bool address_space_pin_direct(AddressSpacePin *pin, hwaddr addr,
+                                            hwaddr len)
+{
+    return addr < pin->len && len <= pin->len - addr &&
+           pin->fv == address_space_to_flatview(pin->as);
+}
+
+MemTxResult address_space_pin_read(AddressSpacePin *pin, hwaddr addr,
+                                   void *buf, hwaddr len)
+{
+    if (likely(address_space_pin_direct(pin, addr, len))) {
+        memcpy(buf, pin->ptr + addr, len);
+        return MEMTX_OK;
+    }
+    return address_space_read(pin->as, pin->addr + addr, pin->attrs, buf, len);
+}
+
+MemTxResult address_space_pin_write(AddressSpacePin *pin, hwaddr addr,
+                                    const void *buf, hwaddr len)
+{
+    assert(pin->is_write);
+    if (likely(address_space_pin_direct(pin, addr, len))) {
+        memcpy(pin->ptr + addr, buf, len);
+        if (pin->dirty_start == pin->dirty_end) {
+            pin->dirty_start = addr;
+            pin->dirty_end = addr + len;
+        } else {
+            pin->dirty_start = MIN(pin->dirty_start, addr);
+            pin->dirty_end = MAX(pin->dirty_end, addr + len);
+        }
+        return MEMTX_OK;
+    }
+    return address_space_write(pin->as, pin->addr + addr, pin->attrs,
+                               buf, len);
+}
+
+void address_space_unpin(AddressSpacePin *pin)
+{
+    if (pin->mr) {
+        if (pin->dirty_end > pin->dirty_start) {
+            invalidate_and_set_dirty(pin->mr, pin->xlat + pin->dirty_start,
+                                     pin->dirty_end - pin->dirty_start);
+        }
+        memory_region_unref(pin->mr);
+    }
+    flatview_unref(pin->fv);
+    pin->mr = NULL;
+    pin->ptr = NULL;
+    pin->fv = NULL;
+}
+
 /* Called from RCU critical section.  This function has the same
  * semantics as address_space_translate, but it only works on a
  * predefined range of a MemoryRegion that was mapped with
@@ -41,6 +41,25 @@ resized to be the same size as the snapshot.  If the snapshot is smaller than
 the backing file, the backing file will not be truncated.  If you want the
 backing file to match the size of the smaller snapshot, you can safely truncate
 it yourself once the commit operation successfully completes.
+ETEXI
+
+    {
+        .name       = "reset_overlay",
+        .args_type  = "device:B",
+        .params     = "device",
+        .help       = "discard all changes to an overlay image, going back to its backing file",
+        .cmd        = hmp_reset_overlay,
+    },
+
+STEXI
+@item reset_overlay @var{device}
+@findex reset_overlay
+Throw away everything written to the top image of @var{device}, or to the
+node named @var{device}, so that it
+reads like its backing file again.  Nothing is written back to the backing
+file.  For qcow2 images opened with @code{fast-reset=on} only the clusters
+written since the image was last empty are discarded.  The guest is not told,
+so this is only safe while it does not cache the disk contents.
 ETEXI
 
     {
@@ -378,6 +397,38 @@ STEXI
 @findex loadvm
 Set the whole virtual machine to the snapshot identified by the tag
 @var{tag} or the unique snapshot ID @var{id}.
+ETEXI
+
+    {
+        .name       = "savevm_mapped",
+        .args_type  = "filename:F",
+        .params     = "filename",
+        .help       = "save the VM state to a file that can be restored with loadvm_mapped",
+        .cmd        = hmp_savevm_mapped,
+    },
+
+STEXI
+@item savevm_mapped @var{filename}
+@findex savevm_mapped
+Save the RAM and device state of the virtual machine to @var{filename}.
+Each RAM block is stored page-aligned at a fixed offset of the file, so
+that @code{loadvm_mapped} can map it instead of reading it.  Disk contents
+are not saved.
+ETEXI
+
+    {
+        .name       = "loadvm_mapped",
+        .args_type  = "filename:F",
+        .params     = "filename",
+        .help       = "restore the VM state saved with savevm_mapped",
+        .cmd        = hmp_loadvm_mapped,
+    },
+
+STEXI
+@item loadvm_mapped @var{filename}
+@findex loadvm_mapped
+Restore the state saved with @code{savevm_mapped} to @var{filename}.  Guest
+RAM is mapped copy-on-write from the file and paged in on first access.
 ETEXI
 
     {
@@ -38,6 +38,7 @@
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-commands-tpm.h"
 #include "qapi/qapi-commands-ui.h"
+#include "qapi/qapi-visit-migration.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/string-input-visitor.h"
@@ -392,6 +393,15 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_PAGE_COUNT),
             params->x_multifd_page_count);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION),
+            MultiFDCompression_str(params->x_multifd_compression));
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_ZLIB_LEVEL),
+            params->x_multifd_zlib_level);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_ZSTD_LEVEL),
+            params->x_multifd_zstd_level);
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -599,6 +609,40 @@ void hmp_info_block(Monitor *mon, const QDict *qdict)
     qapi_free_BlockDeviceInfoList(blockdev_list);
 }
 
+/* Print the driver specific statistics of a device and its protocol nodes */
+static void hmp_info_blockstats_specific(Monitor *mon, BlockStats *stats)
+{
+    for (; stats; stats = stats->has_parent ? stats->parent : NULL) {
+        BlockStatsSpecificPrivmem *privmem;
+
+        if (!stats->has_driver_specific) {
+            continue;
+        }
+
+        switch (stats->driver_specific->driver) {
+        case BLOCKDEV_DRIVER_PRIVMEM:
+            privmem = &stats->driver_specific->u.privmem;
+            monitor_printf(mon, "    privmem: rd_bytes=%" PRIu64
+                           " wr_bytes=%" PRIu64
+                           " zero_rd_bytes=%" PRIu64
+                           " zero_wr_bytes=%" PRIu64
+                           " copy_ups=%" PRIu64
+                           " resets=%" PRIu64
+                           " dirty=%" PRIu64 "/%" PRIu64
+                           " zero=%" PRIu64 "/%" PRIu64 "\n",
+                           privmem->read_bytes, privmem->write_bytes,
+                           privmem->zero_read_bytes,
+                           privmem->zero_write_bytes,
+                           privmem->copy_ups, privmem->resets,
+                           privmem->dirty_clusters, privmem->clusters,
+                           privmem->zero_clusters, privmem->clusters);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 void hmp_info_blockstats(Monitor *mon, const QDict *qdict)
 {
     BlockStatsList *stats_list, *stats;
@@ -634,6 +678,7 @@ void hmp_info_blockstats(Monitor *mon, const QDict *qdict)
                        stats->value->stats->rd_merged,
                        stats->value->stats->wr_merged,
                        stats->value->stats->idle_time_ns);
+        hmp_info_blockstats_specific(mon, stats->value);
     }
 
     qapi_free_BlockStatsList(stats_list);
@@ -1402,6 +1447,22 @@ void hmp_savevm(Monitor *mon, const QDict *qdict)
     hmp_handle_error(mon, &err);
 }
 
+void hmp_loadvm_mapped(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_loadvm_mapped(qdict_get_str(qdict, "filename"), &err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_savevm_mapped(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_savevm_mapped(qdict_get_str(qdict, "filename"), &err);
+    hmp_handle_error(mon, &err);
+}
+
 void hmp_delvm(Monitor *mon, const QDict *qdict)
 {
     BlockDriverState *bs;
@@ -1743,6 +1804,19 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_x_multifd_page_count = true;
         visit_type_int(v, param, &p->x_multifd_page_count, &err);
         break;
+    case MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION:
+        p->has_x_multifd_compression = true;
+        visit_type_MultiFDCompression(v, param, &p->x_multifd_compression,
+                                      &err);
+        break;
+    case MIGRATION_PARAMETER_X_MULTIFD_ZLIB_LEVEL:
+        p->has_x_multifd_zlib_level = true;
+        visit_type_uint8(v, param, &p->x_multifd_zlib_level, &err);
+        break;
+    case MIGRATION_PARAMETER_X_MULTIFD_ZSTD_LEVEL:
+        p->has_x_multifd_zstd_level = true;
+        visit_type_uint8(v, param, &p->x_multifd_zstd_level, &err);
+        break;
     case MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE:
         p->has_xbzrle_cache_size = true;
         visit_type_size(v, param, &cache_size, &err);
@@ -370,6 +370,20 @@ static void machine_set_mem_merge(Object *obj, bool value, Error **errp)
     ms->mem_merge = value;
 }
 
+static bool machine_get_mem_hugepages(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return ms->mem_hugepages;
+}
+
+static void machine_set_mem_hugepages(Object *obj, bool value, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    ms->mem_hugepages = value;
+}
+
 static bool machine_get_usb(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -721,6 +735,11 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "mem-merge",
         "Enable/disable memory merge support", &error_abort);
 
+    object_class_property_add_bool(oc, "mem-hugepages",
+        machine_get_mem_hugepages, machine_set_mem_hugepages, &error_abort);
+    object_class_property_set_description(oc, "mem-hugepages",
+        "Back guest memory with transparent hugepages", &error_abort);
+
     object_class_property_add_bool(oc, "usb",
         machine_get_usb, machine_set_usb, &error_abort);
     object_class_property_set_description(oc, "usb",
@@ -784,6 +803,7 @@ static void machine_initfn(Object *obj)
     ms->kvm_shadow_mem = -1;
     ms->dump_guest_core = true;
     ms->mem_merge = true;
+    ms->mem_hugepages = true;
     ms->enable_graphics = true;
 
     /* Register notifier when init is done for sysbus sanity checks */
@@ -846,6 +866,11 @@ bool machine_mem_merge(MachineState *machine)
     return machine->mem_merge;
 }
 
+bool machine_mem_hugepages(MachineState *machine)
+{
+    return machine->mem_hugepages;
+}
+
 static char *cpu_slot_to_string(const CPUArchId *cpu)
 {
     GString *s = g_string_new(NULL);
@@ -25,6 +25,7 @@
  *
  */
 #include "qemu/osdep.h"
+#include "qapi/error.h"
 #include "qemu-common.h"
 #include "cpu.h"
 #include "hw/hw.h"
@@ -34,6 +35,7 @@
 #include "hw/ppc/spapr.h"
 #include "hw/ppc/spapr_vio.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/dma.h"
 #include "trace.h"
 
 #include <libfdt.h>
@@ -41,6 +43,13 @@
 #define ETH_ALEN        6
 #define MAX_PACKET_SIZE 65536
 
+/*
+ * Upper bound of host mappings used to gather one frame in batch mode: the
+ * six buffer descriptors of H_SEND_LOGICAL_LAN, each of which may be split
+ * once per TCE page it crosses.
+ */
+#define VLAN_TX_MAX_IOV (6 + MAX_PACKET_SIZE / SPAPR_TCE_PAGE_SIZE)
+
 /* Compatibility flags for migration */
 #define SPAPRVLAN_FLAG_RX_BUF_POOLS_BIT  0
 #define SPAPRVLAN_FLAG_RX_BUF_POOLS      (1 << SPAPRVLAN_FLAG_RX_BUF_POOLS_BIT)
@@ -107,6 +116,12 @@ typedef struct VIOsPAPRVLANDevice {
     QEMUTimer *rxp_timer;
     uint32_t compat_flags;             /* Compatibility flags for migration */
     RxBufPool *rx_pool[RX_MAX_POOLS];  /* Receive buffer descriptor pools */
+    bool batch;                        /* Batched-frame mode */
+    uint32_t rx_coalesce_frames;       /* RX frames per interrupt (batch) */
+    uint32_t rx_coalesce_usecs;        /* Max. RX interrupt delay (batch) */
+    uint32_t rx_irq_pending;           /* Frames not signalled yet */
+    QEMUTimer *rx_irq_timer;
+    bool dma_pin;                      /* Pin RX buffer and queue entry */
 } VIOsPAPRVLANDevice;
 
 static int spapr_vlan_can_receive(NetClientState *nc)
@@ -200,6 +215,91 @@ static vlan_bd_t spapr_vlan_get_rx_bd_from_page(VIOsPAPRVLANDevice *dev,
     return bd;
 }
 
+static void spapr_vlan_rx_irq_fire(VIOsPAPRVLANDevice *dev)
+{
+    VIOsPAPRDevice *sdev = VIO_SPAPR_DEVICE(dev);
+
+    trace_spapr_vlan_rx_irq_fire(dev->rx_irq_pending);
+
+    timer_del(dev->rx_irq_timer);
+    dev->rx_irq_pending = 0;
+
+    if (sdev->signal_state & 1) {
+        qemu_irq_pulse(spapr_vio_qirq(sdev));
+    }
+}
+
+static void spapr_vlan_rx_irq_timeout(void *opaque)
+{
+    spapr_vlan_rx_irq_fire(opaque);
+}
+
+/**
+ * Signal a received frame to the guest. In batch mode, the interrupt is
+ * held back until rx-coalesce-frames frames have arrived, the guest ran
+ * out of receive buffers, or rx-coalesce-usecs have passed since the first
+ * frame that has not been signalled yet.
+ */
+static void spapr_vlan_rx_irq(VIOsPAPRVLANDevice *dev)
+{
+    dev->rx_irq_pending++;
+
+    if (!dev->batch || dev->rx_irq_pending >= dev->rx_coalesce_frames ||
+        !dev->rx_bufs) {
+        spapr_vlan_rx_irq_fire(dev);
+        return;
+    }
+
+    if (dev->rx_irq_pending == 1) {
+        timer_mod(dev->rx_irq_timer, qemu_clock_get_us(QEMU_CLOCK_VIRTUAL) +
+                  dev->rx_coalesce_usecs);
+    }
+}
+
+/*
+ * Write a received frame and its receive queue entry with one translation
+ * of the buffer and one of the entry, instead of one per access.
+ */
+static int spapr_vlan_receive_pinned(VIOsPAPRVLANDevice *dev,
+                                     vlan_bd_t rxq_bd, vlan_bd_t bd,
+                                     const uint8_t *buf, size_t size,
+                                     uint8_t control)
+{
+    VIOsPAPRDevice *sdev = VIO_SPAPR_DEVICE(dev);
+    AddressSpacePin buf_pin, rxq_pin;
+    uint8_t entry[16];
+    int ret = 0;
+
+    address_space_pin(&buf_pin, &sdev->as, VLAN_BD_ADDR(bd), size + 8, true,
+                      MEMTXATTRS_UNSPECIFIED);
+    if (address_space_pin_write(&buf_pin, 8, buf, size) != MEMTX_OK) {
+        ret = -1;
+        goto out;
+    }
+
+    trace_spapr_vlan_receive_dma_completed();
+
+    /* The handle is in the first 8 bytes of the buffer */
+    address_space_pin_read(&buf_pin, 0, &entry[8], 8);
+    stl_be_p(&entry[4], size);
+    stw_be_p(&entry[2], 8);
+
+    address_space_pin(&rxq_pin, &sdev->as, VLAN_BD_ADDR(rxq_bd) + dev->rxq_ptr,
+                      sizeof(entry), true, MEMTXATTRS_UNSPECIFIED);
+    address_space_pin_write(&rxq_pin, 2, &entry[2], sizeof(entry) - 2);
+    /* The guest must see the frame before the valid bit */
+    smp_wmb();
+    address_space_pin_write(&rxq_pin, 0, &control, 1);
+    address_space_pin_read(&rxq_pin, 0, entry, sizeof(entry));
+    address_space_unpin(&rxq_pin);
+
+    trace_spapr_vlan_receive_wrote(dev->rxq_ptr, ldq_be_p(&entry[0]),
+                                   ldq_be_p(&entry[8]));
+out:
+    address_space_unpin(&buf_pin);
+    return ret;
+}
+
 static ssize_t spapr_vlan_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
@@ -233,6 +333,19 @@ static ssize_t spapr_vlan_receive(NetClientState *nc, const uint8_t *buf,
 
     dev->rx_bufs--;
 
+    control = VLAN_RXQC_TOGGLE | VLAN_RXQC_VALID;
+    if (rxq_bd & VLAN_BD_TOGGLE) {
+        control ^= VLAN_RXQC_TOGGLE;
+    }
+
+    if (dev->dma_pin) {
+        if (spapr_vlan_receive_pinned(dev, rxq_bd, bd, buf, size,
+                                      control) < 0) {
+            return -1;
+        }
+        goto done;
+    }
+
     /* Transfer the packet data */
     if (spapr_vio_dma_write(sdev, VLAN_BD_ADDR(bd) + 8, buf, size) < 0) {
         return -1;
@@ -241,11 +354,6 @@ static ssize_t spapr_vlan_receive(NetClientState *nc, const uint8_t *buf,
     trace_spapr_vlan_receive_dma_completed();
 
     /* Update the receive queue */
-    control = VLAN_RXQC_TOGGLE | VLAN_RXQC_VALID;
-    if (rxq_bd & VLAN_BD_TOGGLE) {
-        control ^= VLAN_RXQC_TOGGLE;
-    }
-
     handle = vio_ldq(sdev, VLAN_BD_ADDR(bd));
     vio_stq(sdev, VLAN_BD_ADDR(rxq_bd) + dev->rxq_ptr + 8, handle);
     vio_stl(sdev, VLAN_BD_ADDR(rxq_bd) + dev->rxq_ptr + 4, size);
@@ -258,15 +366,14 @@ static ssize_t spapr_vlan_receive(NetClientState *nc, const uint8_t *buf,
                                    vio_ldq(sdev, VLAN_BD_ADDR(rxq_bd) +
                                                  dev->rxq_ptr + 8));
 
+done:
     dev->rxq_ptr += 16;
     if (dev->rxq_ptr >= VLAN_BD_LEN(rxq_bd)) {
         dev->rxq_ptr = 0;
         vio_stq(sdev, dev->buf_list + VLAN_RXQ_BD_OFF, rxq_bd ^ VLAN_BD_TOGGLE);
     }
 
-    if (sdev->signal_state & 1) {
-        qemu_irq_pulse(spapr_vio_qirq(sdev));
-    }
+    spapr_vlan_rx_irq(dev);
 
     return size;
 }
@@ -304,6 +411,8 @@ static void spapr_vlan_reset(VIOsPAPRDevice *sdev)
     dev->buf_list = 0;
     dev->rx_bufs = 0;
     dev->isopen = 0;
+    dev->rx_irq_pending = 0;
+    timer_del(dev->rx_irq_timer);
 
     if (dev->compat_flags & SPAPRVLAN_FLAG_RX_BUF_POOLS) {
         for (i = 0; i < RX_MAX_POOLS; i++) {
@@ -320,6 +429,11 @@ static void spapr_vlan_realize(VIOsPAPRDevice *sdev, Error **errp)
 {
     VIOsPAPRVLANDevice *dev = VIO_SPAPR_VLAN_DEVICE(sdev);
 
+    if (dev->batch && !dev->rx_coalesce_frames) {
+        error_setg(errp, "rx-coalesce-frames must be at least 1");
+        return;
+    }
+
     qemu_macaddr_default_if_unset(&dev->nicconf.macaddr);
 
     memcpy(&dev->perm_mac.a, &dev->nicconf.macaddr.a, sizeof(dev->perm_mac.a));
@@ -330,6 +444,8 @@ static void spapr_vlan_realize(VIOsPAPRDevice *sdev, Error **errp)
 
     dev->rxp_timer = timer_new_us(QEMU_CLOCK_VIRTUAL, spapr_vlan_flush_rx_queue,
                                   dev);
+    dev->rx_irq_timer = timer_new_us(QEMU_CLOCK_VIRTUAL,
+                                     spapr_vlan_rx_irq_timeout, dev);
 }
 
 static void spapr_vlan_instance_init(Object *obj)
@@ -365,6 +481,11 @@ static void spapr_vlan_instance_finalize(Object *obj)
         timer_del(dev->rxp_timer);
         timer_free(dev->rxp_timer);
     }
+
+    if (dev->rx_irq_timer) {
+        timer_del(dev->rx_irq_timer);
+        timer_free(dev->rx_irq_timer);
+    }
 }
 
 void spapr_vlan_create(VIOsPAPRBus *bus, NICInfo *nd)
@@ -677,6 +798,59 @@ static target_ulong h_add_logical_lan_buffer(PowerPCCPU *cpu,
     return H_SUCCESS;
 }
 
+/**
+ * Batch mode transmit: map the guest buffers of one frame and hand them to
+ * the net layer as a scatter list, instead of copying every descriptor into
+ * a bounce buffer first. Returns false if the buffers could not be mapped
+ * directly, so the caller falls back to the copying path.
+ */
+static bool spapr_vlan_send_gather(VIOsPAPRVLANDevice *dev,
+                                   target_ulong *bufs, int nbufs,
+                                   unsigned total_len)
+{
+    VIOsPAPRDevice *sdev = VIO_SPAPR_DEVICE(dev);
+    struct iovec iov[VLAN_TX_MAX_IOV];
+    dma_addr_t addr, len, mlen;
+    int i, niov = 0;
+    bool ok = true;
+
+    for (i = 0; i < nbufs && ok; i++) {
+        addr = VLAN_BD_ADDR(bufs[i]);
+        len = VLAN_BD_LEN(bufs[i]);
+
+        while (len) {
+            if (niov == VLAN_TX_MAX_IOV) {
+                ok = false;
+                break;
+            }
+
+            mlen = len;
+            iov[niov].iov_base = dma_memory_map(&sdev->as, addr, &mlen,
+                                                DMA_DIRECTION_TO_DEVICE);
+            if (!iov[niov].iov_base) {
+                ok = false;
+                break;
+            }
+            iov[niov++].iov_len = mlen;
+
+            addr += mlen;
+            len -= mlen;
+        }
+    }
+
+    if (ok) {
+        trace_spapr_vlan_send_gather(niov, total_len);
+        qemu_sendv_packet(qemu_get_queue(dev->nic), iov, niov);
+    }
+
+    for (i = 0; i < niov; i++) {
+        dma_memory_unmap(&sdev->as, iov[i].iov_base, iov[i].iov_len,
+                         DMA_DIRECTION_TO_DEVICE, 0);
+    }
+
+    return ok;
+}
+
 static target_ulong h_send_logical_lan(PowerPCCPU *cpu,
                                        sPAPRMachineState *spapr,
                                        target_ulong opcode, target_ulong *args)
@@ -728,6 +902,10 @@ static target_ulong h_send_logical_lan(PowerPCCPU *cpu,
         return H_RESOURCE;
     }
 
+    if (dev->batch && spapr_vlan_send_gather(dev, bufs, nbufs, total_len)) {
+        return H_SUCCESS;
+    }
+
     lbuf = alloca(total_len);
     p = lbuf;
     for (i = 0; i < nbufs; i++) {
@@ -784,6 +962,12 @@ static Property spapr_vlan_properties[] = {
     DEFINE_NIC_PROPERTIES(VIOsPAPRVLANDevice, nicconf),
     DEFINE_PROP_BIT("use-rx-buffer-pools", VIOsPAPRVLANDevice,
                     compat_flags, SPAPRVLAN_FLAG_RX_BUF_POOLS_BIT, true),
+    DEFINE_PROP_BOOL("batch", VIOsPAPRVLANDevice, batch, false),
+    DEFINE_PROP_UINT32("rx-coalesce-frames", VIOsPAPRVLANDevice,
+                       rx_coalesce_frames, 16),
+    DEFINE_PROP_UINT32("rx-coalesce-usecs", VIOsPAPRVLANDevice,
+                       rx_coalesce_usecs, 100),
+    DEFINE_PROP_BOOL("x-dma-pin", VIOsPAPRVLANDevice, dma_pin, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -820,6 +1004,38 @@ static const VMStateDescription vmstate_rx_pools = {
     }
 };
 
+static bool spapr_vlan_rx_irq_pending_needed(void *opaque)
+{
+    VIOsPAPRVLANDevice *dev = opaque;
+
+    return dev->rx_irq_pending != 0;
+}
+
+static int spapr_vlan_rx_irq_pending_post_load(void *opaque, int version_id)
+{
+    VIOsPAPRVLANDevice *dev = opaque;
+
+    /* Don't leave the guest waiting for frames that arrived before */
+    if (dev->rx_irq_pending) {
+        timer_mod(dev->rx_irq_timer, qemu_clock_get_us(QEMU_CLOCK_VIRTUAL) +
+                  dev->rx_coalesce_usecs);
+    }
+
+    return 0;
+}
+
+static const VMStateDescription vmstate_rx_irq_pending = {
+    .name = "spapr_llan/rx_irq_pending",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = spapr_vlan_rx_irq_pending_needed,
+    .post_load = spapr_vlan_rx_irq_pending_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(rx_irq_pending, VIOsPAPRVLANDevice),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_spapr_llan = {
     .name = "spapr_llan",
     .version_id = 1,
@@ -838,6 +1054,7 @@ static const VMStateDescription vmstate_spapr_llan = {
     },
     .subsections = (const VMStateDescription * []) {
         &vmstate_rx_pools,
+        &vmstate_rx_irq_pending,
         NULL
     }
 };
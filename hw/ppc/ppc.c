@@ -37,6 +37,7 @@
 #include "sysemu/kvm.h"
 #include "kvm_ppc.h"
 #include "trace.h"
+#include "afl.h"
 
 //#define PPC_DEBUG_IRQ
 //#define PPC_DEBUG_TB
@@ -476,6 +477,91 @@ void ppce500_set_mpic_proxy(bool enabled)
 /*****************************************************************************/
 /* PowerPC time base and decrementer emulation */
 
+/* With -aflFuzzClock the timebase, the decrementers and PURR are driven by
+ * a deterministic clock that advances by a fixed amount per executed
+ * block, rather than by QEMU_CLOCK_VIRTUAL.  Reads then never query the
+ * host clock and two runs of the same input see the same time.
+ */
+static uint64_t ppc_fuzz_clock_ns;
+
+uint64_t cpu_ppc_clock_ns(void)
+{
+    if (aflFuzzClock) {
+        return atomic_read(&ppc_fuzz_clock_ns);
+    }
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+static void cpu_ppc_fuzz_clock_update(CPUPPCState *env)
+{
+    ppc_tb_t *tb_env = env->tb_env;
+    uint64_t deadline = UINT64_MAX;
+
+    if (tb_env->fuzz_armed & PPC_FUZZ_DECR_ARMED) {
+        deadline = MIN(deadline, tb_env->decr_next);
+    }
+    if (tb_env->fuzz_armed & PPC_FUZZ_HDECR_ARMED) {
+        deadline = MIN(deadline, tb_env->hdecr_next);
+    }
+    env->tb_deadline_ns = deadline;
+}
+
+/* Called at block boundaries once the fuzz clock has passed
+ * env->tb_deadline_ns: deliver whatever decrementer has expired.
+ */
+void cpu_ppc_fuzz_clock_expire(CPUPPCState *env)
+{
+    PowerPCCPU *cpu = ppc_env_get_cpu(env);
+    ppc_tb_t *tb_env = env->tb_env;
+    uint64_t now = cpu_ppc_clock_ns();
+
+    if (!tb_env) {
+        env->tb_deadline_ns = UINT64_MAX;
+        return;
+    }
+    if ((tb_env->fuzz_armed & PPC_FUZZ_DECR_ARMED) &&
+        tb_env->decr_next <= now) {
+        tb_env->fuzz_armed &= ~PPC_FUZZ_DECR_ARMED;
+        tb_env->decr_timer->cb(cpu);
+    }
+    if ((tb_env->fuzz_armed & PPC_FUZZ_HDECR_ARMED) &&
+        tb_env->hdecr_next <= now) {
+        tb_env->fuzz_armed &= ~PPC_FUZZ_HDECR_ARMED;
+        tb_env->hdecr_timer->cb(cpu);
+    }
+    cpu_ppc_fuzz_clock_update(env);
+}
+
+/* A halted CPU executes no blocks and would never see its decrementer
+ * fire; skip the fuzz clock straight to the next deadline instead.
+ */
+void cpu_ppc_fuzz_clock_idle(CPUPPCState *env)
+{
+    uint64_t now, deadline = env->tb_deadline_ns;
+
+    if (!aflFuzzClock || deadline == UINT64_MAX) {
+        return;
+    }
+    now = atomic_read(&ppc_fuzz_clock_ns);
+    while (now < deadline) {
+        uint64_t old = atomic_cmpxchg(&ppc_fuzz_clock_ns, now, deadline);
+        if (old == now) {
+            break;
+        }
+        now = old;
+    }
+    cpu_ppc_fuzz_clock_expire(env);
+}
+
+void cpu_ppc_fuzz_clock_tick(CPUPPCState *env)
+{
+    uint64_t now = atomic_fetch_add(&ppc_fuzz_clock_ns, aflFuzzClock);
+
+    if (unlikely(now + aflFuzzClock >= env->tb_deadline_ns)) {
+        cpu_ppc_fuzz_clock_expire(env);
+    }
+}
+
 uint64_t cpu_ppc_get_tb(ppc_tb_t *tb_env, uint64_t vmclk, int64_t tb_offset)
 {
     /* TB time in tb periods */
@@ -491,7 +577,7 @@ uint64_t cpu_ppc_load_tbl (CPUPPCState *env)
         return env->spr[SPR_TBL];
     }
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->tb_offset);
+    tb = cpu_ppc_get_tb(tb_env, cpu_ppc_clock_ns(), tb_env->tb_offset);
     LOG_TB("%s: tb %016" PRIx64 "\n", __func__, tb);
 
     return tb;
@@ -502,7 +588,7 @@ static inline uint32_t _cpu_ppc_load_tbu(CPUPPCState *env)
     ppc_tb_t *tb_env = env->tb_env;
     uint64_t tb;
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->tb_offset);
+    tb = cpu_ppc_get_tb(tb_env, cpu_ppc_clock_ns(), tb_env->tb_offset);
     LOG_TB("%s: tb %016" PRIx64 "\n", __func__, tb);
 
     return tb >> 32;
@@ -530,23 +616,23 @@ static inline void cpu_ppc_store_tb(ppc_tb_t *tb_env, uint64_t vmclk,
 void cpu_ppc_store_tbl (CPUPPCState *env, uint32_t value)
 {
     ppc_tb_t *tb_env = env->tb_env;
-    uint64_t tb;
+    uint64_t tb, vmclk;
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->tb_offset);
+    vmclk = cpu_ppc_clock_ns();
+    tb = cpu_ppc_get_tb(tb_env, vmclk, tb_env->tb_offset);
     tb &= 0xFFFFFFFF00000000ULL;
-    cpu_ppc_store_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
-                     &tb_env->tb_offset, tb | (uint64_t)value);
+    cpu_ppc_store_tb(tb_env, vmclk, &tb_env->tb_offset, tb | (uint64_t)value);
 }
 
 static inline void _cpu_ppc_store_tbu(CPUPPCState *env, uint32_t value)
 {
     ppc_tb_t *tb_env = env->tb_env;
-    uint64_t tb;
+    uint64_t tb, vmclk;
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->tb_offset);
+    vmclk = cpu_ppc_clock_ns();
+    tb = cpu_ppc_get_tb(tb_env, vmclk, tb_env->tb_offset);
     tb &= 0x00000000FFFFFFFFULL;
-    cpu_ppc_store_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
-                     &tb_env->tb_offset, ((uint64_t)value << 32) | tb);
+    cpu_ppc_store_tb(tb_env, vmclk, &tb_env->tb_offset, ((uint64_t)value << 32) | tb);
 }
 
 void cpu_ppc_store_tbu (CPUPPCState *env, uint32_t value)
@@ -559,7 +645,7 @@ uint64_t cpu_ppc_load_atbl (CPUPPCState *env)
     ppc_tb_t *tb_env = env->tb_env;
     uint64_t tb;
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->atb_offset);
+    tb = cpu_ppc_get_tb(tb_env, cpu_ppc_clock_ns(), tb_env->atb_offset);
     LOG_TB("%s: tb %016" PRIx64 "\n", __func__, tb);
 
     return tb;
@@ -570,7 +656,7 @@ uint32_t cpu_ppc_load_atbu (CPUPPCState *env)
     ppc_tb_t *tb_env = env->tb_env;
     uint64_t tb;
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->atb_offset);
+    tb = cpu_ppc_get_tb(tb_env, cpu_ppc_clock_ns(), tb_env->atb_offset);
     LOG_TB("%s: tb %016" PRIx64 "\n", __func__, tb);
 
     return tb >> 32;
@@ -579,23 +665,23 @@ uint32_t cpu_ppc_load_atbu (CPUPPCState *env)
 void cpu_ppc_store_atbl (CPUPPCState *env, uint32_t value)
 {
     ppc_tb_t *tb_env = env->tb_env;
-    uint64_t tb;
+    uint64_t tb, vmclk;
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->atb_offset);
+    vmclk = cpu_ppc_clock_ns();
+    tb = cpu_ppc_get_tb(tb_env, vmclk, tb_env->atb_offset);
     tb &= 0xFFFFFFFF00000000ULL;
-    cpu_ppc_store_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
-                     &tb_env->atb_offset, tb | (uint64_t)value);
+    cpu_ppc_store_tb(tb_env, vmclk, &tb_env->atb_offset, tb | (uint64_t)value);
 }
 
 void cpu_ppc_store_atbu (CPUPPCState *env, uint32_t value)
 {
     ppc_tb_t *tb_env = env->tb_env;
-    uint64_t tb;
+    uint64_t tb, vmclk;
 
-    tb = cpu_ppc_get_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), tb_env->atb_offset);
+    vmclk = cpu_ppc_clock_ns();
+    tb = cpu_ppc_get_tb(tb_env, vmclk, tb_env->atb_offset);
     tb &= 0x00000000FFFFFFFFULL;
-    cpu_ppc_store_tb(tb_env, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
-                     &tb_env->atb_offset, ((uint64_t)value << 32) | tb);
+    cpu_ppc_store_tb(tb_env, vmclk, &tb_env->atb_offset, ((uint64_t)value << 32) | tb);
 }
 
 static void cpu_ppc_tb_stop (CPUPPCState *env)
@@ -605,7 +691,7 @@ static void cpu_ppc_tb_stop (CPUPPCState *env)
 
     /* If the time base is already frozen, do nothing */
     if (tb_env->tb_freq != 0) {
-        vmclk = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        vmclk = cpu_ppc_clock_ns();
         /* Get the time base */
         tb = cpu_ppc_get_tb(tb_env, vmclk, tb_env->tb_offset);
         /* Get the alternate time base */
@@ -627,7 +713,7 @@ static void cpu_ppc_tb_start (CPUPPCState *env)
 
     /* If the time base is not frozen, do nothing */
     if (tb_env->tb_freq == 0) {
-        vmclk = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        vmclk = cpu_ppc_clock_ns();
         /* Get the time base from tb_offset */
         tb = tb_env->tb_offset;
         /* Get the alternate time base from atb_offset */
@@ -654,7 +740,7 @@ static inline uint32_t _cpu_ppc_load_decr(CPUPPCState *env, uint64_t next)
     uint32_t decr;
     int64_t diff;
 
-    diff = next - qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    diff = next - cpu_ppc_clock_ns();
     if (diff >= 0) {
         decr = muldiv64(diff, tb_env->decr_freq, NANOSECONDS_PER_SECOND);
     } else if (tb_env->flags & PPC_TIMER_BOOKE) {
@@ -690,7 +776,7 @@ uint64_t cpu_ppc_load_purr (CPUPPCState *env)
     ppc_tb_t *tb_env = env->tb_env;
     uint64_t diff;
 
-    diff = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - tb_env->purr_start;
+    diff = cpu_ppc_clock_ns() - tb_env->purr_start;
 
     return tb_env->purr_load +
         muldiv64(diff, tb_env->tb_freq, NANOSECONDS_PER_SECOND);
@@ -777,10 +863,18 @@ static void __cpu_ppc_store_decr(PowerPCCPU *cpu, uint64_t *nextp,
     }
 
     /* Calculate the next timer event */
-    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    now = cpu_ppc_clock_ns();
     next = now + muldiv64(value, NANOSECONDS_PER_SECOND, tb_env->decr_freq);
     *nextp = next;
 
+    if (aflFuzzClock) {
+        /* Expiry is checked against the fuzz clock at block boundaries */
+        tb_env->fuzz_armed |= timer == tb_env->decr_timer ?
+                              PPC_FUZZ_DECR_ARMED : PPC_FUZZ_HDECR_ARMED;
+        cpu_ppc_fuzz_clock_update(env);
+        return;
+    }
+
     /* Adjust timer */
     timer_mod(timer, next);
 }
@@ -840,7 +934,7 @@ static void cpu_ppc_store_purr(PowerPCCPU *cpu, uint64_t value)
     ppc_tb_t *tb_env = cpu->env.tb_env;
 
     tb_env->purr_load = value;
-    tb_env->purr_start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    tb_env->purr_start = cpu_ppc_clock_ns();
 }
 
 static void cpu_ppc_set_tb_clk (void *opaque, uint32_t freq)
@@ -966,6 +1060,7 @@ clk_setup_cb cpu_ppc_tb_init (CPUPPCState *env, uint32_t freq)
 
     tb_env = g_malloc0(sizeof(ppc_tb_t));
     env->tb_env = tb_env;
+    env->tb_deadline_ns = UINT64_MAX;
     tb_env->flags = PPC_DECR_UNDERFLOW_TRIGGERED;
     if (env->insns_flags & PPC_SEGMENT_64B) {
         /* All Book3S 64bit CPUs implement level based DEC logic */
@@ -1855,6 +1855,27 @@ target_ulong spapr_hypercall(PowerPCCPU *cpu, target_ulong opcode,
     return H_FUNCTION;
 }
 
+uint64_t qtest_hcall(uint64_t opcode, uint32_t nargs, uint64_t *args)
+{
+    target_ulong hargs[9] = { 0 };
+    uint64_t ret;
+    uint32_t i;
+
+    nargs = MIN(nargs, ARRAY_SIZE(hargs));
+    for (i = 0; i < nargs; i++) {
+        hargs[i] = args[i];
+    }
+
+    ret = spapr_hypercall(POWERPC_CPU(first_cpu), opcode, hargs);
+
+    /* Hypercalls return their outputs in the argument registers */
+    for (i = 0; i < nargs; i++) {
+        args[i] = hargs[i];
+    }
+
+    return ret;
+}
+
 static void hypercall_register_types(void)
 {
     /* hcall-pft */
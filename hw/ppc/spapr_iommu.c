@@ -42,6 +42,9 @@ enum sPAPRTCEAccess {
 #define IOMMU_PAGE_SIZE(shift)      (1ULL << (shift))
 #define IOMMU_PAGE_MASK(shift)      (~(IOMMU_PAGE_SIZE(shift) - 1))
 
+/* Largest block merged into a single IOMMU notification */
+#define SPAPR_TCE_NOTIFY_MAX_ORDER  30
+
 static QLIST_HEAD(, sPAPRTCETable) spapr_tce_tables;
 
 sPAPRTCETable *spapr_tce_find_by_liobn(target_ulong liobn)
@@ -109,6 +112,132 @@ static void spapr_tce_free_table(uint64_t *table, int fd, uint32_t nb_table)
     }
 }
 
+static IOMMUTLBEntry spapr_tce_entry(sPAPRTCETable *tcet, unsigned long index)
+{
+    hwaddr page_mask = IOMMU_PAGE_MASK(tcet->page_shift);
+    uint64_t tce = tcet->table[index];
+    IOMMUTLBEntry entry = {
+        .target_as = &address_space_memory,
+        .iova = (hwaddr)index << tcet->page_shift,
+        .translated_addr = tce & page_mask,
+        .addr_mask = ~page_mask,
+        .perm = spapr_tce_iommu_access_flags(tce),
+    };
+
+    return entry;
+}
+
+/*
+ * Check that TCEs [index, index + n) can be described by one IOMMUTLBEntry:
+ * same permissions and, unless they fault, a naturally aligned contiguous
+ * target range.  Mapped blocks never exceed a memory block so that they
+ * cannot straddle two RAM regions.
+ */
+static bool spapr_tce_block_mappable(sPAPRTCETable *tcet, unsigned long index,
+                                     unsigned long n)
+{
+    hwaddr page_mask = IOMMU_PAGE_MASK(tcet->page_shift);
+    hwaddr size = (hwaddr)n << tcet->page_shift;
+    uint64_t first = tcet->table[index];
+    IOMMUAccessFlags perm = spapr_tce_iommu_access_flags(first);
+    unsigned long i;
+
+    if (perm != IOMMU_NONE &&
+        (size > SPAPR_MEMORY_BLOCK_SIZE || (first & page_mask & (size - 1)))) {
+        return false;
+    }
+
+    for (i = 1; i < n; i++) {
+        uint64_t tce = tcet->table[index + i];
+
+        if (spapr_tce_iommu_access_flags(tce) != perm) {
+            return false;
+        }
+        if (perm != IOMMU_NONE &&
+            (tce & page_mask) != (first & page_mask) +
+                                 ((hwaddr)i << tcet->page_shift)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Order of the largest naturally aligned block containing @index which
+ * stays within [lo, hi) and is mappable as a whole.
+ */
+static unsigned spapr_tce_block_order(sPAPRTCETable *tcet, unsigned long index,
+                                      unsigned long lo, unsigned long hi,
+                                      unsigned max_order)
+{
+    unsigned order = 0;
+
+    while (order < max_order) {
+        unsigned long n = 1UL << (order + 1);
+        unsigned long start = index & ~(n - 1);
+
+        if (start < lo || start + n > hi ||
+            !spapr_tce_block_mappable(tcet, start, n)) {
+            break;
+        }
+        order++;
+    }
+
+    return order;
+}
+
+/*
+ * Drop all cached translations.  Callers update the table first and
+ * invalidate once per hypercall rather than once per TCE.
+ */
+static void spapr_tce_cache_invalidate(sPAPRTCETable *tcet)
+{
+    qemu_spin_lock(&tcet->cache_lock);
+    if (++tcet->cache_gen == 0) {
+        /* Generation 0 marks free slots, start over with an empty cache */
+        memset(tcet->cache, 0, sizeof(tcet->cache));
+        tcet->cache_gen = 1;
+    }
+    qemu_spin_unlock(&tcet->cache_lock);
+}
+
+/* Called from RCU critical section */
+static IOMMUTLBEntry spapr_tce_cache_lookup(sPAPRTCETable *tcet,
+                                            unsigned long index)
+{
+    unsigned slot = (index >> SPAPR_TCE_CACHE_ORDER) % SPAPR_TCE_CACHE_SIZE;
+    sPAPRTCECacheEntry *e = &tcet->cache[slot];
+    hwaddr iova = (hwaddr)index << tcet->page_shift;
+    IOMMUTLBEntry ret = {
+        .target_as = &address_space_memory,
+    };
+
+    qemu_spin_lock(&tcet->cache_lock);
+    if (e->gen == tcet->cache_gen && (iova & ~e->addr_mask) == e->iova) {
+        tcet->cache_hits++;
+    } else {
+        unsigned order = spapr_tce_block_order(tcet, index, 0, tcet->nb_table,
+                                               SPAPR_TCE_CACHE_ORDER);
+        IOMMUTLBEntry block = spapr_tce_entry(tcet,
+                                              index & ~((1UL << order) - 1));
+
+        e->gen = tcet->cache_gen;
+        e->perm = block.perm;
+        e->iova = block.iova;
+        e->translated_addr = block.translated_addr;
+        e->addr_mask = ((hwaddr)1 << (tcet->page_shift + order)) - 1;
+        tcet->cache_misses++;
+    }
+    ret.iova = e->iova;
+    ret.translated_addr = e->translated_addr;
+    ret.addr_mask = e->addr_mask;
+    ret.perm = e->perm;
+    qemu_spin_unlock(&tcet->cache_lock);
+
+    return ret;
+}
+
 /* Called from RCU critical section */
 static IOMMUTLBEntry spapr_tce_translate_iommu(IOMMUMemoryRegion *iommu,
                                                hwaddr addr,
@@ -116,7 +245,7 @@ static IOMMUTLBEntry spapr_tce_translate_iommu(IOMMUMemoryRegion *iommu,
                                                int iommu_idx)
 {
     sPAPRTCETable *tcet = container_of(iommu, sPAPRTCETable, iommu);
-    uint64_t tce;
+    unsigned long index = addr >> tcet->page_shift;
     IOMMUTLBEntry ret = {
         .target_as = &address_space_memory,
         .iova = 0,
@@ -125,15 +254,14 @@ static IOMMUTLBEntry spapr_tce_translate_iommu(IOMMUMemoryRegion *iommu,
         .perm = IOMMU_NONE,
     };
 
-    if ((addr >> tcet->page_shift) < tcet->nb_table) {
-        /* Check if we are in bound */
-        hwaddr page_mask = IOMMU_PAGE_MASK(tcet->page_shift);
-
-        tce = tcet->table[addr >> tcet->page_shift];
-        ret.iova = addr & page_mask;
-        ret.translated_addr = tce & page_mask;
-        ret.addr_mask = ~page_mask;
-        ret.perm = spapr_tce_iommu_access_flags(tce);
+    /* Check if we are in bound */
+    if (index < tcet->nb_table) {
+        if (tcet->fd >= 0) {
+            /* KVM may update an in-kernel table behind our back */
+            ret = spapr_tce_entry(tcet, index);
+        } else {
+            ret = spapr_tce_cache_lookup(tcet, index);
+        }
     }
     trace_spapr_iommu_xlate(tcet->liobn, addr, ret.iova, ret.perm,
                             ret.addr_mask);
@@ -141,6 +269,24 @@ static IOMMUTLBEntry spapr_tce_translate_iommu(IOMMUMemoryRegion *iommu,
     return ret;
 }
 
+/*
+ * Translations may cover several TCEs, replay page by page so that a
+ * notifier sees every mapping exactly once.
+ */
+static void spapr_tce_replay(IOMMUMemoryRegion *iommu, IOMMUNotifier *n)
+{
+    sPAPRTCETable *tcet = container_of(iommu, sPAPRTCETable, iommu);
+    unsigned long i;
+
+    for (i = 0; i < tcet->nb_table; i++) {
+        IOMMUTLBEntry entry = spapr_tce_entry(tcet, i);
+
+        if (entry.perm != IOMMU_NONE) {
+            n->notify(n, &entry);
+        }
+    }
+}
+
 static int spapr_tce_table_pre_save(void *opaque)
 {
     sPAPRTCETable *tcet = SPAPR_TCE_TABLE(opaque);
@@ -210,6 +356,7 @@ static int spapr_tce_table_post_load(void *opaque, int version_id)
 
         memcpy(tcet->table, tcet->mig_table,
                tcet->nb_table * sizeof(tcet->table[0]));
+        spapr_tce_cache_invalidate(tcet);
 
         free(tcet->mig_table);
         tcet->mig_table = NULL;
@@ -272,6 +419,8 @@ static void spapr_tce_table_realize(DeviceState *dev, Error **errp)
 
     tcet->fd = -1;
     tcet->need_vfio = false;
+    qemu_spin_init(&tcet->cache_lock);
+    tcet->cache_gen = 1;
     tmp = g_strdup_printf("tce-root-%x", tcet->liobn);
     memory_region_init(&tcet->root, tcetobj, tmp, UINT64_MAX);
     g_free(tmp);
@@ -282,6 +431,15 @@ static void spapr_tce_table_realize(DeviceState *dev, Error **errp)
                              tcetobj, tmp, 0);
     g_free(tmp);
 
+    object_property_add_uint64_ptr(tcetobj, "cache-hits",
+                                   &tcet->cache_hits, NULL);
+    object_property_add_uint64_ptr(tcetobj, "cache-misses",
+                                   &tcet->cache_misses, NULL);
+    object_property_add_uint64_ptr(tcetobj, "notify-events",
+                                   &tcet->notify_events, NULL);
+    object_property_add_uint64_ptr(tcetobj, "notify-pages",
+                                   &tcet->notify_pages, NULL);
+
     QLIST_INSERT_HEAD(&spapr_tce_tables, tcet, list);
 
     vmstate_register(DEVICE(tcet), tcet->liobn, &vmstate_spapr_tce_table,
@@ -315,6 +473,7 @@ void spapr_tce_set_need_vfio(sPAPRTCETable *tcet, bool need_vfio)
     spapr_tce_free_table(oldtable, tcet->fd, tcet->nb_table);
 
     tcet->fd = newfd;
+    spapr_tce_cache_invalidate(tcet);
 }
 
 sPAPRTCETable *spapr_tce_new_table(DeviceState *owner, uint32_t liobn)
@@ -360,6 +519,8 @@ void spapr_tce_table_enable(sPAPRTCETable *tcet,
                                         &tcet->fd,
                                         tcet->need_vfio);
 
+    spapr_tce_cache_invalidate(tcet);
+
     memory_region_set_size(MEMORY_REGION(&tcet->iommu),
                            (uint64_t)tcet->nb_table << tcet->page_shift);
     memory_region_add_subregion(&tcet->root, tcet->bus_offset,
@@ -381,6 +542,7 @@ void spapr_tce_table_disable(sPAPRTCETable *tcet)
     tcet->bus_offset = 0;
     tcet->page_shift = 0;
     tcet->nb_table = 0;
+    spapr_tce_cache_invalidate(tcet);
 }
 
 static void spapr_tce_table_unrealize(DeviceState *dev, Error **errp)
@@ -406,15 +568,51 @@ static void spapr_tce_reset(DeviceState *dev)
 
     if (tcet->nb_table) {
         memset(tcet->table, 0, table_size);
+        spapr_tce_cache_invalidate(tcet);
     }
 }
 
+static unsigned long spapr_tce_index(sPAPRTCETable *tcet, target_ulong ioba)
+{
+    return (ioba - tcet->bus_offset) >> tcet->page_shift;
+}
+
+/*
+ * Notify IOMMU listeners of TCEs [index, index + npages), merging runs
+ * which form a mappable block into a single event.
+ */
+static void spapr_tce_notify_range(sPAPRTCETable *tcet, unsigned long index,
+                                   unsigned long npages)
+{
+    unsigned long end = index + npages;
+
+    spapr_tce_cache_invalidate(tcet);
+
+    if (QLIST_EMPTY(&tcet->iommu.iommu_notify)) {
+        return;
+    }
+
+    while (index < end) {
+        unsigned order = spapr_tce_block_order(tcet, index, index, end,
+                                               SPAPR_TCE_NOTIFY_MAX_ORDER);
+        IOMMUTLBEntry entry = spapr_tce_entry(tcet, index);
+
+        entry.addr_mask = ((hwaddr)1 << (tcet->page_shift + order)) - 1;
+        trace_spapr_iommu_notify(tcet->liobn, entry.iova, entry.addr_mask + 1,
+                                 entry.perm);
+        memory_region_notify_iommu(&tcet->iommu, 0, entry);
+
+        tcet->notify_events++;
+        tcet->notify_pages += 1UL << order;
+        index += 1UL << order;
+    }
+}
+
+/* Store a TCE, the caller notifies the range it updated */
 static target_ulong put_tce_emu(sPAPRTCETable *tcet, target_ulong ioba,
                                 target_ulong tce)
 {
-    IOMMUTLBEntry entry;
-    hwaddr page_mask = IOMMU_PAGE_MASK(tcet->page_shift);
-    unsigned long index = (ioba - tcet->bus_offset) >> tcet->page_shift;
+    unsigned long index = spapr_tce_index(tcet, ioba);
 
     if (index >= tcet->nb_table) {
         hcall_dprintf("spapr_vio_put_tce on out-of-bounds IOBA 0x"
@@ -424,13 +622,6 @@ static target_ulong put_tce_emu(sPAPRTCETable *tcet, target_ulong ioba,
 
     tcet->table[index] = tce;
 
-    entry.target_as = &address_space_memory,
-    entry.iova = (ioba - tcet->bus_offset) & page_mask;
-    entry.translated_addr = tce & page_mask;
-    entry.addr_mask = ~page_mask;
-    entry.perm = spapr_tce_iommu_access_flags(tce);
-    memory_region_notify_iommu(&tcet->iommu, 0, entry);
-
     return H_SUCCESS;
 }
 
@@ -469,6 +660,10 @@ static target_ulong h_put_tce_indirect(PowerPCCPU *cpu,
             break;
         }
     }
+    if (i) {
+        spapr_tce_notify_range(tcet, spapr_tce_index(tcet, ioba1 & page_mask),
+                               i);
+    }
 
     /* Trace last successful or the first problematic entry */
     i = i ? (i - 1) : 0;
@@ -491,6 +686,7 @@ static target_ulong h_stuff_tce(PowerPCCPU *cpu, sPAPRMachineState *spapr,
     target_ulong ret = H_PARAMETER;
     sPAPRTCETable *tcet = spapr_tce_find_by_liobn(liobn);
     hwaddr page_mask, page_size;
+    unsigned long index;
 
     if (!tcet) {
         return H_PARAMETER;
@@ -503,6 +699,7 @@ static target_ulong h_stuff_tce(PowerPCCPU *cpu, sPAPRMachineState *spapr,
     page_mask = IOMMU_PAGE_MASK(tcet->page_shift);
     page_size = IOMMU_PAGE_SIZE(tcet->page_shift);
     ioba &= page_mask;
+    index = spapr_tce_index(tcet, ioba);
 
     for (i = 0; i < npages; ++i, ioba += page_size) {
         ret = put_tce_emu(tcet, ioba, tce_value);
@@ -510,6 +707,9 @@ static target_ulong h_stuff_tce(PowerPCCPU *cpu, sPAPRMachineState *spapr,
             break;
         }
     }
+    if (i) {
+        spapr_tce_notify_range(tcet, index, i);
+    }
     if (SPAPR_IS_PCI_LIOBN(liobn)) {
         trace_spapr_iommu_pci_stuff(liobn, ioba, tce_value, npages, ret);
     } else {
@@ -534,6 +734,9 @@ static target_ulong h_put_tce(PowerPCCPU *cpu, sPAPRMachineState *spapr,
         ioba &= page_mask;
 
         ret = put_tce_emu(tcet, ioba, tce);
+        if (!ret) {
+            spapr_tce_notify_range(tcet, spapr_tce_index(tcet, ioba), 1);
+        }
     }
     if (SPAPR_IS_PCI_LIOBN(liobn)) {
         trace_spapr_iommu_pci_put(liobn, ioba, tce, ret);
@@ -547,7 +750,7 @@ static target_ulong h_put_tce(PowerPCCPU *cpu, sPAPRMachineState *spapr,
 static target_ulong get_tce_emu(sPAPRTCETable *tcet, target_ulong ioba,
                                 target_ulong *tce)
 {
-    unsigned long index = (ioba - tcet->bus_offset) >> tcet->page_shift;
+    unsigned long index = spapr_tce_index(tcet, ioba);
 
     if (index >= tcet->nb_table) {
         hcall_dprintf("spapr_iommu_get_tce on out-of-bounds IOBA 0x"
@@ -662,6 +865,7 @@ static void spapr_iommu_memory_region_class_init(ObjectClass *klass, void *data)
     imrc->get_min_page_size = spapr_tce_get_min_page_size;
     imrc->notify_flag_changed = spapr_tce_notify_flag_changed;
     imrc->get_attr = spapr_tce_get_attr;
+    imrc->replay = spapr_tce_replay;
 }
 
 static const TypeInfo spapr_iommu_memory_region_info = {
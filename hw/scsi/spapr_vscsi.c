@@ -84,6 +84,10 @@ typedef struct vscsi_req {
     uint16_t                cdb_offset;
     uint16_t                cur_desc_num;
     uint16_t                cur_desc_offset;
+
+    /* SRP descriptors mapped for direct DMA by the SCSI layer */
+    QEMUSGList              qsg;
+    bool                    sg_mapped;
 } vscsi_req;
 
 #define TYPE_VIO_SPAPR_VSCSI_DEVICE "spapr-vscsi"
@@ -132,6 +136,10 @@ static void vscsi_put_req(vscsi_req *req)
     if (req->sreq != NULL) {
         scsi_req_unref(req->sreq);
     }
+    if (req->sg_mapped) {
+        qemu_sglist_destroy(&req->qsg);
+        req->sg_mapped = false;
+    }
     req->sreq = NULL;
     req->active = 0;
 }
@@ -508,6 +516,63 @@ static int vscsi_preprocess_desc(vscsi_req *req)
     return 0;
 }
 
+/* Describe the whole SRP descriptor list to the SCSI layer as a
+ * scatter/gather list, so that the backend does its DMA straight into
+ * guest memory through the TCE table instead of bouncing each descriptor
+ * through vscsi_transfer_data().  Returns NULL, and so falls back to the
+ * bounce path, if any descriptor cannot be fetched or is not mapped.
+ */
+static QEMUSGList *vscsi_get_sg_list(SCSIRequest *sreq)
+{
+    VSCSIState *s = VIO_SPAPR_VSCSI_DEVICE(sreq->bus->qbus.parent);
+    vscsi_req *req = sreq->hba_private;
+    struct srp_direct_buf md;
+    uint32_t remaining = sreq->cmd.xfer;
+    DMADirection dir;
+    unsigned n;
+    int rc;
+
+    if (req == NULL || sreq->cmd.mode == SCSI_XFER_NONE || !remaining) {
+        return NULL;
+    }
+
+    /* Same as what vscsi_queue_cmd() derives from scsi_req_enqueue() */
+    req->writing = sreq->cmd.mode == SCSI_XFER_TO_DEV;
+    dir = req->writing ? DMA_DIRECTION_TO_DEVICE : DMA_DIRECTION_FROM_DEVICE;
+    if (vscsi_preprocess_desc(req) < 0 || req->dma_fmt == SRP_NO_DATA_DESC) {
+        return NULL;
+    }
+
+    qemu_sglist_init(&req->qsg, DEVICE(&s->vdev), req->total_desc,
+                     &s->vdev.as);
+    for (n = 0; n < req->total_desc && remaining; n++) {
+        uint32_t len;
+
+        rc = vscsi_fetch_desc(s, req, n, 0, &md);
+        if (rc < 0) {
+            goto fallback;
+        } else if (rc == 0) {
+            continue;
+        }
+
+        len = MIN(md.len, remaining);
+        if (!spapr_vio_dma_valid(&s->vdev, md.va, len, dir)) {
+            goto fallback;
+        }
+        qemu_sglist_add(&req->qsg, md.va, len);
+        remaining -= len;
+    }
+
+    trace_spapr_vscsi_get_sg_list(req->qtag, req->qsg.nsg, req->qsg.size);
+    req->sg_mapped = true;
+    return &req->qsg;
+
+fallback:
+    trace_spapr_vscsi_get_sg_list_fallback(req->qtag, n);
+    qemu_sglist_destroy(&req->qsg);
+    return NULL;
+}
+
 /* Callback to indicate that the SCSI layer has completed a transfer.  */
 static void vscsi_transfer_data(SCSIRequest *sreq, uint32_t len)
 {
@@ -563,6 +628,12 @@ static void vscsi_command_complete(SCSIRequest *sreq, uint32_t status, size_t re
     }
 
     trace_spapr_vscsi_command_complete_status(status);
+    if (sreq->sg) {
+        /* The data went straight through the SG list, not through
+         * vscsi_transfer_data(), so take the residual from the SCSI layer.
+         */
+        req->data_len = resid;
+    }
     if (status == 0) {
         /* We handle overflows, not underflows for normal commands,
          * but hopefully nobody cares
@@ -1181,6 +1252,7 @@ static const struct SCSIBusInfo vscsi_scsi_info = {
     .max_lun = 31,
 
     .transfer_data = vscsi_transfer_data,
+    .get_sg_list = vscsi_get_sg_list,
     .complete = vscsi_command_complete,
     .cancel = vscsi_request_cancelled,
     .save_request = vscsi_save_request,
@@ -1427,6 +1427,11 @@ uint64_t vhost_get_features(struct vhost_dev *hdev, const int *feature_bits,
                             uint64_t features)
 {
     const int *bit = feature_bits;
+
+    /* vhost has no way to hand over the packed ring state (wrap counters)
+     * on start/stop, whatever the backend advertises.
+     */
+    features &= ~(1ULL << VIRTIO_F_RING_PACKED);
     while (*bit != VHOST_INVALID_FEATURE_BIT) {
         uint64_t bit_mask = (1ULL << *bit);
         if (!(hdev->features & bit_mask)) {
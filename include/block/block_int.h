@@ -205,6 +205,12 @@ struct BlockDriver {
     int coroutine_fn (*bdrv_co_pdiscard)(BlockDriverState *bs,
         int64_t offset, int bytes);
 
+    /* Called after copy-on-read has allocated [offset, offset + bytes) in
+     * @bs.  The data did not change, so dirty bitmaps are not touched;
+     * drivers that track what their own layer holds can record it here. */
+    void (*bdrv_copy_on_read_written)(BlockDriverState *bs,
+        int64_t offset, int64_t bytes);
+
     /* Map [offset, offset + nbytes) range onto a child of @bs to copy from,
      * and invoke bdrv_co_copy_range_from(child, ...), or invoke
      * bdrv_co_copy_range_to() if @bs is the leaf child to copy data from.
@@ -320,6 +326,7 @@ struct BlockDriver {
                                   Error **errp);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs);
+    BlockStatsSpecific *(*bdrv_get_specific_stats)(BlockDriverState *bs);
 
     int coroutine_fn (*bdrv_save_vmstate)(BlockDriverState *bs,
                                           QEMUIOVector *qiov,
@@ -390,6 +397,12 @@ struct BlockDriver {
     void (*bdrv_attach_aio_context)(BlockDriverState *bs,
                                     AioContext *new_context);
 
+    /* Called in the child after a fork of the AFL fork server, with no
+     * in-flight requests.  The state inherited from the parent is what
+     * the child starts from.
+     */
+    void (*bdrv_fork_child)(BlockDriverState *bs);
+
     /* io queue for linux-aio */
     void (*bdrv_io_plug)(BlockDriverState *bs);
     void (*bdrv_io_unplug)(BlockDriverState *bs);
@@ -262,6 +262,8 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   int mmu_idx, target_ulong size);
 void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
                  uintptr_t retaddr);
+void probe_read(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
+                uintptr_t retaddr);
 #else
 static inline void tlb_init(CPUState *cpu)
 {
@@ -1736,6 +1736,72 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
                                          unsigned size,
                                          MemTxAttrs attrs);
 
+/**
+ * MemoryRegionFastDispatch: the device callbacks of a #MemoryRegion, bound
+ * ahead of time for the access sizes that memory_region_dispatch_read() and
+ * memory_region_dispatch_write() would pass through unchanged.
+ *
+ * @mr: the #MemoryRegion that was bound, or %NULL
+ * @opaque: the opaque pointer of @mr
+ * @read: the read callback of @mr
+ * @write: the write callback of @mr
+ * @read_sizes: the access sizes in bytes, ORed together, that can be
+ *              handed to @read directly
+ * @write_sizes: same as @read_sizes, for @write
+ * @unaligned: whether @mr accepts unaligned accesses
+ * @bswap: whether the data must be byte swapped
+ */
+typedef struct MemoryRegionFastDispatch {
+    MemoryRegion *mr;
+    void *opaque;
+    uint64_t (*read)(void *opaque, hwaddr addr, unsigned size);
+    void (*write)(void *opaque, hwaddr addr, uint64_t data, unsigned size);
+    uint8_t read_sizes;
+    uint8_t write_sizes;
+    bool unaligned;
+    bool bswap;
+} MemoryRegionFastDispatch;
+
+/**
+ * memory_region_fast_dispatch_init: bind the callbacks of a #MemoryRegion
+ *
+ * @fd: the #MemoryRegionFastDispatch to fill
+ * @mr: the #MemoryRegion to bind
+ */
+void memory_region_fast_dispatch_init(MemoryRegionFastDispatch *fd,
+                                      MemoryRegion *mr);
+
+/**
+ * memory_region_fast_dispatch_read: read through a #MemoryRegionFastDispatch
+ *
+ * Returns %true if the access was done, %false if it must go through
+ * memory_region_dispatch_read() instead.
+ *
+ * @fd: the #MemoryRegionFastDispatch of the region
+ * @addr: address within the region
+ * @pval: pointer to uint64_t which the data is written to
+ * @size: size of the access in bytes
+ */
+bool memory_region_fast_dispatch_read(const MemoryRegionFastDispatch *fd,
+                                      hwaddr addr, uint64_t *pval,
+                                      unsigned size);
+
+/**
+ * memory_region_fast_dispatch_write: write through a
+ * #MemoryRegionFastDispatch
+ *
+ * Returns %true if the access was done, %false if it must go through
+ * memory_region_dispatch_write() instead.
+ *
+ * @fd: the #MemoryRegionFastDispatch of the region
+ * @addr: address within the region
+ * @data: data to write
+ * @size: size of the access in bytes
+ */
+bool memory_region_fast_dispatch_write(const MemoryRegionFastDispatch *fd,
+                                       hwaddr addr, uint64_t data,
+                                       unsigned size);
+
 /**
  * address_space_init: initializes an address space
  *
@@ -1968,6 +2034,78 @@ void address_space_cache_invalidate(MemoryRegionCache *cache,
  */
 void address_space_cache_destroy(MemoryRegionCache *cache);
 
+/**
+ * AddressSpacePin: a guest physical range mapped once for repeated access
+ *
+ * Unlike #MemoryRegionCache, the range is translated through IOMMUs, and
+ * writes only mark the memory dirty when the mapping is released.  Accesses
+ * fall back to address_space_read()/address_space_write() when the range is
+ * not RAM, when they go beyond the part of the range that could be mapped,
+ * or when the memory map of the address space changed since it was pinned.
+ * Like address_space_map(), a pin must be released after a bounded time,
+ * because dirty tracking and TB invalidation lag until then.
+ */
+typedef struct AddressSpacePin {
+    AddressSpace *as;
+    FlatView *fv;
+    MemoryRegion *mr;
+    void *ptr;
+    hwaddr addr;
+    hwaddr xlat;
+    hwaddr len;
+    hwaddr dirty_start;
+    hwaddr dirty_end;
+    MemTxAttrs attrs;
+    bool is_write;
+} AddressSpacePin;
+
+/**
+ * address_space_pin: map a guest physical range for repeated access
+ *
+ * Returns the number of bytes, starting at @addr, that could be mapped
+ * directly; accesses beyond that still work but are not accelerated.
+ *
+ * @pin: #AddressSpacePin to be filled
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @len: length of the range
+ * @is_write: whether the range will be written to
+ * @attrs: memory transaction attributes to use for the accesses
+ */
+hwaddr address_space_pin(AddressSpacePin *pin, AddressSpace *as, hwaddr addr,
+                         hwaddr len, bool is_write, MemTxAttrs attrs);
+
+/**
+ * address_space_pin_read: read from a pinned range
+ *
+ * @pin: #AddressSpacePin filled by address_space_pin()
+ * @addr: address relative to the start of the pinned range
+ * @buf: buffer with the data transferred
+ * @len: length of the data transferred
+ */
+MemTxResult address_space_pin_read(AddressSpacePin *pin, hwaddr addr,
+                                   void *buf, hwaddr len);
+
+/**
+ * address_space_pin_write: write to a pinned range
+ *
+ * @pin: #AddressSpacePin filled by address_space_pin() with @is_write
+ * @addr: address relative to the start of the pinned range
+ * @buf: buffer with the data transferred
+ * @len: length of the data transferred
+ */
+MemTxResult address_space_pin_write(AddressSpacePin *pin, hwaddr addr,
+                                    const void *buf, hwaddr len);
+
+/**
+ * address_space_unpin: release a pinned range
+ *
+ * Marks the bytes written through the pin as dirty, in one go.
+ *
+ * @pin: #AddressSpacePin filled by address_space_pin()
+ */
+void address_space_unpin(AddressSpacePin *pin);
+
 /* address_space_get_iotlb_entry: translate an address into an IOTLB
  * entry. Should be called from an RCU critical section.
  */
@@ -120,6 +120,18 @@ int qemu_ram_resize(RAMBlock *block, ram_addr_t newsize, Error **errp);
 
 void tb_invalidate_phys_range(ram_addr_t start, ram_addr_t end);
 
+typedef struct DirtyRing DirtyRing;
+typedef void DirtyRingFunc(ram_addr_t addr, void *opaque);
+
+void cpu_physical_memory_dirty_ring_init(void);
+void cpu_physical_memory_dirty_ring_add_cpu(CPUState *cpu);
+void cpu_physical_memory_dirty_ring_remove_cpu(CPUState *cpu);
+void cpu_physical_memory_dirty_ring_set(unsigned long *bitmap,
+                                        unsigned long offset,
+                                        unsigned long page,
+                                        unsigned long nr);
+bool cpu_physical_memory_dirty_ring_collect(DirtyRingFunc *fn, void *opaque);
+
 static inline bool cpu_physical_memory_get_dirty(ram_addr_t start,
                                                  ram_addr_t length,
                                                  unsigned client)
@@ -288,8 +300,14 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
         unsigned long next = MIN(end, base + DIRTY_MEMORY_BLOCK_SIZE);
 
         if (likely(mask & (1 << DIRTY_MEMORY_MIGRATION))) {
-            bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
-                              offset, next - page);
+            if (unlikely(tcg_dirty_ring_size)) {
+                cpu_physical_memory_dirty_ring_set(
+                    blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
+                    offset, page, next - page);
+            } else {
+                bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
+                                  offset, next - page);
+            }
         }
         if (unlikely(mask & (1 << DIRTY_MEMORY_VGA))) {
             bitmap_set_atomic(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
@@ -343,20 +361,18 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
             blocks[i] = atomic_rcu_read(&ram_list.dirty_memory[i])->blocks;
         }
 
-        for (k = 0; k < nr; k++) {
-            if (bitmap[k]) {
-                unsigned long temp = leul_to_cpu(bitmap[k]);
-
-                atomic_or(&blocks[DIRTY_MEMORY_MIGRATION][idx][offset], temp);
-                atomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
-                if (tcg_enabled()) {
-                    atomic_or(&blocks[DIRTY_MEMORY_CODE][idx][offset], temp);
-                }
-            }
-
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
-                offset = 0;
-                idx++;
+        for (k = find_next_nonzero_word(bitmap, nr, 0); k < nr;
+             k = find_next_nonzero_word(bitmap, nr, k + 1)) {
+            unsigned long temp = leul_to_cpu(bitmap[k]);
+            unsigned long i_idx = idx + (offset + k) /
+                                  BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE);
+            unsigned long i_off = (offset + k) %
+                                  BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE);
+
+            atomic_or(&blocks[DIRTY_MEMORY_MIGRATION][i_idx][i_off], temp);
+            atomic_or(&blocks[DIRTY_MEMORY_VGA][i_idx][i_off], temp);
+            if (tcg_enabled()) {
+                atomic_or(&blocks[DIRTY_MEMORY_CODE][i_idx][i_off], temp);
             }
         }
 
@@ -435,21 +451,27 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         src = atomic_rcu_read(
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = atomic_xchg(&src[idx][offset], 0);
+        /* Walk one DIRTY_MEMORY_BLOCK_SIZE chunk at a time, skipping
+         * the clean words of the chunk in bulk.
+         */
+        for (k = page; k < page + nr; idx++, offset = 0) {
+            unsigned long *chunk = src[idx];
+            unsigned long end = MIN(BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE),
+                                    offset + (page + nr - k));
+            unsigned long i;
+
+            for (i = find_next_nonzero_word(chunk, end, offset); i < end;
+                 i = find_next_nonzero_word(chunk, end, i + 1)) {
+                unsigned long bits = atomic_xchg(&chunk[i], 0);
                 unsigned long new_dirty;
+                unsigned long d = k + (i - offset);
                 *real_dirty_pages += ctpopl(bits);
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
+                new_dirty = ~dest[d];
+                dest[d] |= bits;
                 new_dirty &= bits;
                 num_dirty += ctpopl(new_dirty);
             }
-
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
-                offset = 0;
-                idx++;
-            }
+            k += end - offset;
         }
 
         rcu_read_unlock();
@@ -472,5 +494,34 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
 
     return num_dirty;
 }
+
+/* Like cpu_physical_memory_sync_dirty_bitmap, for the single page of @rb at
+ * @start; used with the pages reported by the dirty rings.
+ */
+static inline
+uint64_t cpu_physical_memory_sync_dirty_page(RAMBlock *rb,
+                                             ram_addr_t start,
+                                             uint64_t *real_dirty_pages)
+{
+    unsigned long page = (start + rb->offset) >> TARGET_PAGE_BITS;
+    unsigned long *chunk;
+    uint64_t num_dirty = 0;
+
+    rcu_read_lock();
+
+    chunk = atomic_rcu_read(&ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])
+            ->blocks[page / DIRTY_MEMORY_BLOCK_SIZE];
+    if (bitmap_test_and_clear_atomic(chunk, page % DIRTY_MEMORY_BLOCK_SIZE,
+                                     1)) {
+        *real_dirty_pages += 1;
+        if (!test_and_set_bit(start >> TARGET_PAGE_BITS, rb->bmap)) {
+            num_dirty++;
+        }
+    }
+
+    rcu_read_unlock();
+
+    return num_dirty;
+}
 #endif
 #endif
@@ -35,6 +35,9 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
+    size_t tb_evict_regions;
+    size_t tb_evict_tbs;
 };
 
 extern TBContext tb_ctx;
@@ -34,8 +34,13 @@ struct ppc_tb_t {
     uint64_t purr_start;
     void *opaque;
     uint32_t flags;
+    uint32_t fuzz_armed;   /* Decrementers pending on the fuzz clock */
 };
 
+/* Decrementers armed against the fuzz clock (ppc_tb_t::fuzz_armed) */
+#define PPC_FUZZ_DECR_ARMED          (1 << 0)
+#define PPC_FUZZ_HDECR_ARMED         (1 << 1)
+
 /* PPC Timers flags */
 #define PPC_TIMER_BOOKE              (1 << 0) /* Enable Booke support */
 #define PPC_TIMER_E500               (1 << 1) /* Enable e500 support */
@@ -51,6 +56,7 @@ struct ppc_tb_t {
                                                */
 
 uint64_t cpu_ppc_get_tb(ppc_tb_t *tb_env, uint64_t vmclk, int64_t tb_offset);
+uint64_t cpu_ppc_clock_ns(void);
 clk_setup_cb cpu_ppc_tb_init (CPUPPCState *env, uint32_t freq);
 /* Embedded PowerPC DCR management */
 typedef uint32_t (*dcr_read_cb)(void *opaque, int dcrn);
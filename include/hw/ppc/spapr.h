@@ -699,6 +699,20 @@ typedef struct sPAPRTCETable sPAPRTCETable;
 #define SPAPR_IOMMU_MEMORY_REGION(obj) \
         OBJECT_CHECK(IOMMUMemoryRegion, (obj), TYPE_SPAPR_IOMMU_MEMORY_REGION)
 
+/* Translations cached per TCE table, each covering up to
+ * 1 << SPAPR_TCE_CACHE_ORDER contiguous IOMMU pages.
+ */
+#define SPAPR_TCE_CACHE_SIZE    16
+#define SPAPR_TCE_CACHE_ORDER   4
+
+typedef struct sPAPRTCECacheEntry {
+    uint32_t gen;               /* 0 if the slot is free */
+    IOMMUAccessFlags perm;
+    hwaddr iova;
+    hwaddr translated_addr;
+    hwaddr addr_mask;
+} sPAPRTCECacheEntry;
+
 struct sPAPRTCETable {
     DeviceState parent;
     uint32_t liobn;
@@ -715,6 +729,15 @@ struct sPAPRTCETable {
     IOMMUMemoryRegion iommu;
     struct VIOsPAPRDevice *vdev; /* for @bypass migration compatibility only */
     QLIST_ENTRY(sPAPRTCETable) list;
+
+    /* Bumped on every table update, invalidating the cache */
+    QemuSpin cache_lock;
+    uint32_t cache_gen;
+    sPAPRTCECacheEntry cache[SPAPR_TCE_CACHE_SIZE];
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t notify_events;
+    uint64_t notify_pages;
 };
 
 sPAPRTCETable *spapr_tce_find_by_liobn(target_ulong liobn);
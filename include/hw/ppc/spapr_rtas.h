@@ -7,4 +7,5 @@
 
 uint64_t qtest_rtas_call(char *cmd, uint32_t nargs, uint64_t args,
                          uint32_t nret, uint64_t rets);
+uint64_t qtest_hcall(uint64_t opcode, uint32_t nargs, uint64_t *args);
 #endif /* HW_SPAPR_RTAS_H */
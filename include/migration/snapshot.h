@@ -17,5 +17,8 @@
 
 int save_snapshot(const char *name, Error **errp);
 int load_snapshot(const char *name, Error **errp);
+int save_mapped_snapshot(const char *filename, Error **errp);
+int save_mapped_snapshot_nostop(const char *filename, Error **errp);
+int load_mapped_snapshot(const char *filename, Error **errp);
 
 #endif
@@ -154,6 +154,22 @@ unsigned long find_next_bit(const unsigned long *addr,
                             unsigned long size,
                             unsigned long offset);
 
+/**
+ * find_next_nonzero_word - find the next non-zero word of a bitmap
+ * @addr: The address to base the search on
+ * @nwords: The bitmap size in words
+ * @start: The word index to start searching at
+ *
+ * Returns the index of the first non-zero word, or @nwords.  Uses
+ * vector instructions when the host has them.
+ */
+unsigned long find_next_nonzero_word(const unsigned long *addr,
+                                     unsigned long nwords,
+                                     unsigned long start);
+
+/* Only for testing: select the next accelerator of find_next_nonzero_word */
+bool test_bitmap_scan_next_accel(void);
+
 /**
  * find_next_zero_bit - find the next cleared bit in a memory region
  * @addr: The address to base the search on
@@ -434,6 +434,12 @@ struct CPUState {
 
     /* track IOMMUs whose translations we've cached in the TCG TLB */
     GArray *iommu_notifiers;
+
+    /* MMIO callbacks bound when filling the TLB, indexed by section */
+    struct MemoryRegionFastDispatch *mmio_dispatch;
+
+    /* pages dirtied by this vCPU, with -accel tcg,dirty-ring-size */
+    struct DirtyRing *dirty_ring;
 };
 
 typedef QTAILQ_HEAD(CPUTailQ, CPUState) CPUTailQ;
@@ -465,6 +471,14 @@ static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
 extern bool mttcg_enabled;
 #define qemu_tcg_mttcg_enabled() (mttcg_enabled)
 
+/**
+ * tcg_dirty_ring_size:
+ * Number of entries of the per-vCPU dirty page rings, or 0 if the pages
+ * dirtied by TCG are only recorded in the dirty bitmaps
+ * (-accel tcg,dirty-ring-size=N).
+ */
+extern uint32_t tcg_dirty_ring_size;
+
 /**
  * cpu_paging_enabled:
  * @cpu: The CPU whose state is to be inspected.
@@ -60,5 +60,6 @@ DriveInfo *drive_new(QemuOpts *arg, BlockInterfaceType block_default_type,
 /* device-hotplug */
 
 void hmp_commit(Monitor *mon, const QDict *qdict);
+void hmp_reset_overlay(Monitor *mon, const QDict *qdict);
 void hmp_drive_del(Monitor *mon, const QDict *qdict);
 #endif
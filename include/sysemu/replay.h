@@ -192,4 +192,19 @@ void replay_vmstate_init(void);
     can be created */
 bool replay_can_snapshot(void);
 
+/* AFL fork server */
+
+/*! Called in the fork server before the first fork.
+    Saves the snapshot that the children's logs start from. */
+void replay_fork_prepare(void);
+/*! Called in every fork server child. Starts recording into memory. */
+void replay_fork_start(void);
+/*! Writes the in-memory log of a crashing fork server child to disk. */
+void replay_fork_save_log(void);
+/*! Returns true if the replayed log was recorded in a fork server child. */
+bool replay_is_fork_log(void);
+/*! Saves the fuzzing input read by the guest to the log in record mode,
+    replaces it with the one from the log in replay mode. */
+void replay_fuzz_input(uint8_t **buf, size_t *size);
+
 #endif
@@ -1511,6 +1511,76 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
     }
 }
 
+void memory_region_fast_dispatch_init(MemoryRegionFastDispatch *fd,
+                                      MemoryRegion *mr)
+{
+    const MemoryRegionOps *ops = mr->ops;
+    unsigned min = ops->impl.min_access_size ? : 1;
+    unsigned max = ops->impl.max_access_size ? : 4;
+    unsigned size, sizes = 0;
+
+    memset(fd, 0, sizeof(*fd));
+    fd->mr = mr;
+
+    /* Leave the regions that trace or check their accesses specially to
+     * the normal path.
+     */
+    if (mr->subpage || mr == &io_mem_notdirty || ops->valid.accepts) {
+        return;
+    }
+
+    /* The sizes for which access_with_adjusted_size makes a single call */
+    for (size = min; size <= max && size <= 8; size <<= 1) {
+        sizes |= size;
+    }
+
+    fd->opaque = mr->opaque;
+    fd->read = ops->read;
+    fd->write = ops->write;
+    fd->read_sizes = ops->read ? sizes : 0;
+    fd->write_sizes = ops->write ? sizes : 0;
+    fd->unaligned = ops->valid.unaligned;
+    fd->bswap = memory_region_wrong_endianness(mr);
+}
+
+bool memory_region_fast_dispatch_read(const MemoryRegionFastDispatch *fd,
+                                      hwaddr addr, uint64_t *pval,
+                                      unsigned size)
+{
+    uint64_t val;
+
+    if (!(fd->read_sizes & size) ||
+        (!fd->unaligned && (addr & (size - 1))) ||
+        trace_event_get_state_backends(TRACE_MEMORY_REGION_OPS_READ)) {
+        return false;
+    }
+
+    val = fd->read(fd->opaque, addr, size) & MAKE_64BIT_MASK(0, size * 8);
+    if (fd->bswap) {
+        adjust_endianness(fd->mr, &val, size);
+    }
+    *pval = val;
+    return true;
+}
+
+bool memory_region_fast_dispatch_write(const MemoryRegionFastDispatch *fd,
+                                       hwaddr addr, uint64_t data,
+                                       unsigned size)
+{
+    if (!(fd->write_sizes & size) ||
+        (!fd->unaligned && (addr & (size - 1))) ||
+        fd->mr->ioeventfd_nb ||
+        trace_event_get_state_backends(TRACE_MEMORY_REGION_OPS_WRITE)) {
+        return false;
+    }
+
+    if (fd->bswap) {
+        adjust_endianness(fd->mr, &data, size);
+    }
+    fd->write(fd->opaque, addr, data & MAKE_64BIT_MASK(0, size * 8), size);
+    return true;
+}
+
 void memory_region_init_io(MemoryRegion *mr,
                            Object *owner,
                            const MemoryRegionOps *ops,
@@ -0,0 +1,557 @@
+/*
+ * Mmap-able VM snapshot files
+ *
+ * Copyright (c) 2018 IBM Corp.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A mapped snapshot stores every migratable RAMBlock page-aligned at a fixed
+ * offset of a plain file, followed by a device-only migration stream:
+ *
+ *   +----------------------------------+  0
+ *   | MappedSnapshotHeader             |
+ *   | MappedSnapshotBlock[nb_blocks]   |
+ *   +----------------------------------+  MAPPED_SNAPSHOT_ALIGN
+ *   | RAMBlock 0 (zero pages are holes)|
+ *   +----------------------------------+  aligned
+ *   | ...                              |
+ *   +----------------------------------+  aligned
+ *   | device state (QEMU_VM_FILE_MAGIC)|
+ *   +----------------------------------+
+ *
+ * On restore, anonymous RAMBlocks are replaced with a MAP_PRIVATE mapping of
+ * the file, so guest memory is paged in lazily on first access and restoring
+ * the same snapshot many times shares the page cache.  Disk contents are not
+ * part of the snapshot.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "exec/ram_addr.h"
+#include "exec/ramlist.h"
+#include "exec/exec-all.h"
+#include "sysemu/cpus.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/hostmem.h"
+#include "sysemu/replay.h"
+#include "io/channel-file.h"
+#include "migration.h"
+#include "migration/snapshot.h"
+#include "migration/misc.h"
+#include "migration/global_state.h"
+#include "qemu-file-channel.h"
+#include "qemu-file.h"
+#include "savevm.h"
+#include "trace.h"
+
+#define MAPPED_SNAPSHOT_MAGIC   0x514d534e  /* "QMSN" */
+#define MAPPED_SNAPSHOT_VERSION 1
+
+/* Large enough for every host page size we map with */
+#define MAPPED_SNAPSHOT_ALIGN   (64 * KiB)
+
+typedef struct QEMU_PACKED MappedSnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nb_blocks;
+    uint32_t reserved;
+    uint64_t devstate_offset;
+    uint64_t devstate_size;
+} MappedSnapshotHeader;
+
+typedef struct QEMU_PACKED MappedSnapshotBlock {
+    char idstr[256];
+    uint64_t used_length;
+    uint64_t offset;
+} MappedSnapshotBlock;
+
+static int mapped_snapshot_pwrite(int fd, const void *buf, size_t len,
+                                  uint64_t offset)
+{
+    while (len) {
+        ssize_t ret = pwrite(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static int mapped_snapshot_pread(int fd, void *buf, size_t len,
+                                 uint64_t offset)
+{
+    while (len) {
+        ssize_t ret = pread(fd, buf, len, offset);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            return -EIO;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/*
+ * Write a block's pages, leaving holes for the zero ones.  The file is
+ * extended past the last block by the device state, so holes read back
+ * as zeroes and never fault beyond EOF when mapped.
+ */
+static int mapped_snapshot_save_block(int fd, RAMBlock *block,
+                                      uint64_t offset)
+{
+    size_t pagesize = qemu_real_host_page_size;
+    size_t done = 0, start;
+    int ret;
+
+    while (done < block->used_length) {
+        while (done < block->used_length &&
+               buffer_is_zero(block->host + done,
+                              MIN(pagesize, block->used_length - done))) {
+            done += pagesize;
+        }
+        start = done;
+        while (done < block->used_length &&
+               !buffer_is_zero(block->host + done,
+                               MIN(pagesize, block->used_length - done))) {
+            done += pagesize;
+        }
+        if (done > start) {
+            ret = mapped_snapshot_pwrite(fd, block->host + start,
+                                         MIN(done, block->used_length) - start,
+                                         offset + start);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+static int mapped_snapshot_save_devices(int fd, uint64_t offset,
+                                        uint64_t *size)
+{
+    QIOChannelFile *ioc;
+    QEMUFile *f;
+    int dupfd, ret;
+
+    dupfd = dup(fd);
+    if (dupfd < 0) {
+        return -errno;
+    }
+    if (lseek(dupfd, offset, SEEK_SET) < 0) {
+        ret = -errno;
+        close(dupfd);
+        return ret;
+    }
+
+    ioc = qio_channel_file_new_fd(dupfd);
+    qio_channel_set_name(QIO_CHANNEL(ioc), "mapped-snapshot-save");
+    f = qemu_fopen_channel_output(QIO_CHANNEL(ioc));
+    object_unref(OBJECT(ioc));
+
+    ret = qemu_save_device_state(f);
+    qemu_fflush(f);
+    *size = qemu_ftell(f);
+    if (!ret) {
+        ret = qemu_file_get_error(f);
+    }
+    qemu_fclose(f);
+    return ret;
+}
+
+static int mapped_snapshot_save_fd(int fd, Error **errp)
+{
+    MappedSnapshotHeader hdr = { 0 };
+    MappedSnapshotBlock *table = NULL;
+    RAMBlock *block;
+    uint64_t offset, devstate_size;
+    uint32_t nb_blocks = 0, i;
+    int ret = 0;
+
+    rcu_read_lock();
+
+    RAMBLOCK_FOREACH(block) {
+        if (qemu_ram_is_migratable(block)) {
+            nb_blocks++;
+        }
+    }
+
+    table = g_new0(MappedSnapshotBlock, nb_blocks);
+    offset = ROUND_UP(sizeof(hdr) + nb_blocks * sizeof(*table),
+                      MAPPED_SNAPSHOT_ALIGN);
+    i = 0;
+
+    RAMBLOCK_FOREACH(block) {
+        if (!qemu_ram_is_migratable(block)) {
+            continue;
+        }
+        pstrcpy(table[i].idstr, sizeof(table[i].idstr), block->idstr);
+        table[i].used_length = cpu_to_be64(block->used_length);
+        table[i].offset = cpu_to_be64(offset);
+
+        trace_mapped_snapshot_save_block(block->idstr, offset,
+                                         block->used_length);
+        ret = mapped_snapshot_save_block(fd, block, offset);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not write RAM block '%s'",
+                             block->idstr);
+            rcu_read_unlock();
+            goto out;
+        }
+        offset = ROUND_UP(offset + block->used_length, MAPPED_SNAPSHOT_ALIGN);
+        i++;
+    }
+
+    rcu_read_unlock();
+
+    ret = mapped_snapshot_save_devices(fd, offset, &devstate_size);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write device state");
+        goto out;
+    }
+
+    hdr.magic = cpu_to_be32(MAPPED_SNAPSHOT_MAGIC);
+    hdr.version = cpu_to_be32(MAPPED_SNAPSHOT_VERSION);
+    hdr.nb_blocks = cpu_to_be32(nb_blocks);
+    hdr.devstate_offset = cpu_to_be64(offset);
+    hdr.devstate_size = cpu_to_be64(devstate_size);
+
+    ret = mapped_snapshot_pwrite(fd, table, nb_blocks * sizeof(*table),
+                                 sizeof(hdr));
+    if (!ret) {
+        ret = mapped_snapshot_pwrite(fd, &hdr, sizeof(hdr), 0);
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write snapshot header");
+        goto out;
+    }
+
+    trace_mapped_snapshot_save(nb_blocks, offset, devstate_size);
+
+out:
+    g_free(table);
+    return ret;
+}
+
+static int mapped_snapshot_save(const char *filename, bool stop,
+                                Error **errp)
+{
+    int saved_vm_running;
+    int fd, ret;
+
+    if (migration_is_blocked(errp)) {
+        return -EINVAL;
+    }
+
+    if (!replay_can_snapshot()) {
+        error_setg(errp, "Record/replay does not allow making snapshot "
+                   "right now. Try once more later.");
+        return -EINVAL;
+    }
+
+    fd = qemu_open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, filename);
+        return -errno;
+    }
+
+    saved_vm_running = runstate_is_running();
+
+    ret = global_state_store();
+    if (ret) {
+        error_setg(errp, "Error saving global state");
+        qemu_close(fd);
+        return ret;
+    }
+    if (stop) {
+        vm_stop(RUN_STATE_SAVE_VM);
+    }
+
+    ret = mapped_snapshot_save_fd(fd, errp);
+    qemu_close(fd);
+    if (ret < 0) {
+        unlink(filename);
+    }
+
+    if (stop && saved_vm_running) {
+        vm_start();
+    }
+    return ret;
+}
+
+int save_mapped_snapshot(const char *filename, Error **errp)
+{
+    return mapped_snapshot_save(filename, true, errp);
+}
+
+/*
+ * For callers whose vCPU threads are already out of the execution loop and
+ * can't be paused, i.e. the AFL fork server.  The snapshot is loaded as
+ * running, like one of a running VM.
+ */
+int save_mapped_snapshot_nostop(const char *filename, Error **errp)
+{
+    return mapped_snapshot_save(filename, false, errp);
+}
+
+/*
+ * Replace the block's memory with the snapshot contents: a private mapping
+ * of the file when the block is plain anonymous memory, a copy otherwise.
+ * Memory backends count as a copy, because their dump, merge and NUMA
+ * policy settings would not carry over to the new mapping.
+ * The block must lie within the file, accessing a mapping past its end
+ * would raise SIGBUS.
+ */
+static int mapped_snapshot_load_block(int fd, uint64_t file_size,
+                                      RAMBlock *block, uint64_t offset,
+                                      Error **errp)
+{
+    size_t pagesize = qemu_real_host_page_size;
+    size_t len = block->used_length;
+    void *addr;
+    int ret;
+
+    if (offset > file_size || len > file_size - offset) {
+        error_setg(errp, "RAM block '%s' at 0x%" PRIx64 " is past the end "
+                   "of the snapshot file", block->idstr, offset);
+        return -EINVAL;
+    }
+
+    if (block->fd < 0 && !qemu_ram_is_shared(block) &&
+        !object_dynamic_cast(block->mr->owner, TYPE_MEMORY_BACKEND) &&
+        block->page_size == pagesize &&
+        QEMU_IS_ALIGNED(offset, pagesize) &&
+        QEMU_IS_ALIGNED((uintptr_t)block->host, pagesize)) {
+        trace_mapped_snapshot_load_block(block->idstr, offset, len, true);
+
+        ram_block_notify_remove(block->host, block->max_length);
+        addr = mmap(block->host, ROUND_UP(len, pagesize),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                    fd, offset);
+        ram_block_notify_add(block->host, block->max_length);
+        if (addr == MAP_FAILED) {
+            /* The old mapping may already be gone, nothing to fall back to */
+            error_setg_errno(errp, errno, "Could not map RAM block '%s'",
+                             block->idstr);
+            return -errno;
+        }
+        /* The new mapping starts out with default advice */
+        qemu_ram_remap_advise(addr, ROUND_UP(len, pagesize));
+    } else {
+        trace_mapped_snapshot_load_block(block->idstr, offset, len, false);
+
+        ret = mapped_snapshot_pread(fd, block->host, len, offset);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read RAM block '%s'",
+                             block->idstr);
+            return ret;
+        }
+    }
+
+    cpu_physical_memory_set_dirty_range(block->offset, len, DIRTY_CLIENTS_ALL);
+    return 0;
+}
+
+static int mapped_snapshot_load_devices(int fd, uint64_t offset)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    QIOChannelFile *ioc;
+    QEMUFile *f;
+    int dupfd, ret;
+
+    dupfd = dup(fd);
+    if (dupfd < 0) {
+        return -errno;
+    }
+    if (lseek(dupfd, offset, SEEK_SET) < 0) {
+        ret = -errno;
+        close(dupfd);
+        return ret;
+    }
+
+    ioc = qio_channel_file_new_fd(dupfd);
+    qio_channel_set_name(QIO_CHANNEL(ioc), "mapped-snapshot-load");
+    f = qemu_fopen_channel_input(QIO_CHANNEL(ioc));
+    object_unref(OBJECT(ioc));
+
+    mis->from_src_file = f;
+    ret = qemu_loadvm_state(f);
+    migration_incoming_state_destroy();
+    return ret;
+}
+
+static int mapped_snapshot_load_fd(int fd, Error **errp)
+{
+    MappedSnapshotHeader hdr;
+    MappedSnapshotBlock *table;
+    RAMBlock *block, **blocks;
+    uint32_t nb_blocks, i;
+    uint64_t offset, used_length, devstate_offset, file_size;
+    struct stat st;
+    int ret;
+
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "Could not stat snapshot file");
+        return -errno;
+    }
+    file_size = st.st_size;
+
+    ret = mapped_snapshot_pread(fd, &hdr, sizeof(hdr), 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read snapshot header");
+        return ret;
+    }
+    if (be32_to_cpu(hdr.magic) != MAPPED_SNAPSHOT_MAGIC) {
+        error_setg(errp, "Not a mapped snapshot file");
+        return -EINVAL;
+    }
+    if (be32_to_cpu(hdr.version) != MAPPED_SNAPSHOT_VERSION) {
+        error_setg(errp, "Unsupported mapped snapshot version %" PRIu32,
+                   be32_to_cpu(hdr.version));
+        return -ENOTSUP;
+    }
+
+    nb_blocks = be32_to_cpu(hdr.nb_blocks);
+    if (nb_blocks > MAPPED_SNAPSHOT_ALIGN / sizeof(*table)) {
+        error_setg(errp, "Invalid number of RAM blocks %" PRIu32, nb_blocks);
+        return -EINVAL;
+    }
+    devstate_offset = be64_to_cpu(hdr.devstate_offset);
+    if (devstate_offset > file_size) {
+        error_setg(errp, "Device state is past the end of the snapshot file");
+        return -EINVAL;
+    }
+
+    table = g_new(MappedSnapshotBlock, nb_blocks);
+    blocks = g_new(RAMBlock *, nb_blocks);
+    ret = mapped_snapshot_pread(fd, table, nb_blocks * sizeof(*table),
+                                sizeof(hdr));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read snapshot header");
+        goto out;
+    }
+
+    rcu_read_lock();
+
+    /* Check the whole table before the guest is touched */
+    for (i = 0; i < nb_blocks; i++) {
+        table[i].idstr[sizeof(table[i].idstr) - 1] = '\0';
+        used_length = be64_to_cpu(table[i].used_length);
+
+        block = qemu_ram_block_by_name(table[i].idstr);
+        if (!block || !qemu_ram_is_migratable(block)) {
+            error_setg(errp, "Unknown RAM block '%s'", table[i].idstr);
+            ret = -EINVAL;
+            break;
+        }
+        if (used_length != block->used_length) {
+            error_setg(errp, "Length mismatch for RAM block '%s': 0x%"
+                       PRIx64 " in snapshot, 0x" RAM_ADDR_FMT " in guest",
+                       block->idstr, used_length, block->used_length);
+            ret = -EINVAL;
+            break;
+        }
+        offset = be64_to_cpu(table[i].offset);
+        if (offset > file_size || used_length > file_size - offset) {
+            error_setg(errp, "RAM block '%s' is past the end of the snapshot "
+                       "file", block->idstr);
+            ret = -EINVAL;
+            break;
+        }
+        blocks[i] = block;
+    }
+    if (ret < 0) {
+        rcu_read_unlock();
+        goto out;
+    }
+
+    qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+
+    for (i = 0; i < nb_blocks; i++) {
+        ret = mapped_snapshot_load_block(fd, file_size, blocks[i],
+                                         be64_to_cpu(table[i].offset), errp);
+        if (ret < 0) {
+            break;
+        }
+    }
+    rcu_read_unlock();
+    if (ret < 0) {
+        goto out;
+    }
+
+    ret = mapped_snapshot_load_devices(fd, devstate_offset);
+    if (ret < 0) {
+        error_setg(errp, "Error %d while loading VM state", ret);
+        goto out;
+    }
+
+    /* Guest code changed under the translation cache */
+    if (tcg_enabled() && first_cpu) {
+        tb_flush(first_cpu);
+    }
+
+    trace_mapped_snapshot_load(nb_blocks);
+
+out:
+    g_free(blocks);
+    g_free(table);
+    return ret;
+}
+
+int load_mapped_snapshot(const char *filename, Error **errp)
+{
+    int fd, ret;
+
+    if (!replay_can_snapshot()) {
+        error_setg(errp, "Record/replay does not allow loading snapshot "
+                   "right now. Try once more later.");
+        return -EINVAL;
+    }
+
+    fd = qemu_open(filename, O_RDONLY);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, filename);
+        return -errno;
+    }
+
+    ret = mapped_snapshot_load_fd(fd, errp);
+
+    /* Established mappings keep the file referenced */
+    qemu_close(fd);
+    return ret;
+}
+
+void qmp_savevm_mapped(const char *filename, Error **errp)
+{
+    save_mapped_snapshot(filename, errp);
+}
+
+void qmp_loadvm_mapped(const char *filename, Error **errp)
+{
+    int saved_vm_running = runstate_is_running();
+
+    vm_stop(RUN_STATE_RESTORE_VM);
+
+    if (load_mapped_snapshot(filename, errp) == 0 && saved_vm_running) {
+        vm_start();
+    }
+}
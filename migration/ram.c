@@ -29,6 +29,9 @@
 #include "qemu/osdep.h"
 #include "cpu.h"
 #include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #include "qemu/cutils.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
@@ -516,10 +519,16 @@ exit:
 /* Multiple fd's */
 
 #define MULTIFD_MAGIC 0x11223344U
-#define MULTIFD_VERSION 1
+#define MULTIFD_VERSION 2
 
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
+/* We reserve 3 bits for the compression method of the packet */
+#define MULTIFD_FLAG_COMPRESSION_MASK (7 << 1)
+#define MULTIFD_FLAG_NOCOMP (0 << 1)
+#define MULTIFD_FLAG_ZLIB (1 << 1)
+#define MULTIFD_FLAG_ZSTD (2 << 1)
+
 typedef struct {
     uint32_t magic;
     uint32_t version;
@@ -533,6 +542,8 @@ typedef struct {
     uint32_t flags;
     uint32_t size;
     uint32_t used;
+    /* size of the compressed pages following the packet, 0 if plain */
+    uint32_t next_packet_size;
     uint64_t packet_num;
     char ramblock[256];
     uint64_t offset[];
@@ -589,6 +600,16 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* compression method, fixed for the whole migration */
+    MultiFDCompression compression;
+    /* compression stream, kept across the packets of the channel */
+    z_stream zs;
+#ifdef CONFIG_ZSTD
+    ZSTD_CStream *zcs;
+#endif
+    /* compressed pages of the current packet */
+    uint8_t *zbuff;
+    uint32_t zbuff_len;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -622,6 +643,16 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* compression method, fixed for the whole migration */
+    MultiFDCompression compression;
+    /* decompression stream, kept across the packets of the channel */
+    z_stream zs;
+#ifdef CONFIG_ZSTD
+    ZSTD_DStream *zds;
+#endif
+    /* compressed pages of the current packet */
+    uint8_t *zbuff;
+    uint32_t zbuff_len;
 } MultiFDRecvParams;
 
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
@@ -710,6 +741,278 @@ static void multifd_pages_clear(MultiFDPages_t *pages)
     g_free(pages);
 }
 
+/* Multifd compression
+ *
+ * Each channel owns one compression stream for the whole migration and
+ * flushes it at the end of every packet, so the receiver can decode a
+ * packet as soon as it arrives while the dictionary keeps growing with
+ * the pages already sent through that channel.  Compressed pages are
+ * sent as a single buffer of next_packet_size bytes after the packet.
+ */
+
+static uint32_t multifd_compression_flag(MultiFDCompression compression)
+{
+    switch (compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        return MULTIFD_FLAG_ZLIB;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        return MULTIFD_FLAG_ZSTD;
+#endif
+    default:
+        return MULTIFD_FLAG_NOCOMP;
+    }
+}
+
+static int multifd_send_compress_setup(MultiFDSendParams *p, Error **errp)
+{
+    p->compression = migrate_multifd_compression();
+    if (p->compression == MULTIFD_COMPRESSION_NONE) {
+        return 0;
+    }
+
+    /* Room for incompressible pages plus the stream overhead */
+    p->zbuff_len = migrate_multifd_page_count() * TARGET_PAGE_SIZE * 2;
+    p->zbuff = g_try_malloc(p->zbuff_len);
+    if (!p->zbuff) {
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        if (deflateInit(&p->zs, migrate_multifd_zlib_level()) != Z_OK) {
+            error_setg(errp, "multifd %d: deflate init failed: %s", p->id,
+                       p->zs.msg ? p->zs.msg : "unknown error");
+            return -1;
+        }
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD: {
+        size_t ret;
+
+        p->zcs = ZSTD_createCStream();
+        if (!p->zcs) {
+            error_setg(errp, "multifd %d: zstd createCStream failed", p->id);
+            return -1;
+        }
+        ret = ZSTD_initCStream(p->zcs, migrate_multifd_zstd_level());
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: zstd initCStream failed: %s", p->id,
+                       ZSTD_getErrorName(ret));
+            return -1;
+        }
+        break;
+    }
+#endif
+    default:
+        g_assert_not_reached();
+    }
+    return 0;
+}
+
+static void multifd_send_compress_cleanup(MultiFDSendParams *p)
+{
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        deflateEnd(&p->zs);
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        ZSTD_freeCStream(p->zcs);
+        p->zcs = NULL;
+        break;
+#endif
+    default:
+        break;
+    }
+    g_free(p->zbuff);
+    p->zbuff = NULL;
+    p->zbuff_len = 0;
+}
+
+/* Returns the compressed size of the pages, or -1 on error */
+static int multifd_send_compress(MultiFDSendParams *p, uint32_t used,
+                                 Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    uint32_t i;
+
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB: {
+        z_stream *zs = &p->zs;
+
+        zs->next_out = p->zbuff;
+        zs->avail_out = p->zbuff_len;
+        for (i = 0; i < used; i++) {
+            int flush = i == used - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+            int ret;
+
+            zs->next_in = iov[i].iov_base;
+            zs->avail_in = iov[i].iov_len;
+            ret = deflate(zs, flush);
+            if (ret != Z_OK || zs->avail_in) {
+                error_setg(errp, "multifd %d: deflate failed: %d", p->id,
+                           ret);
+                return -1;
+            }
+        }
+        return p->zbuff_len - zs->avail_out;
+    }
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD: {
+        ZSTD_outBuffer out = { .dst = p->zbuff, .size = p->zbuff_len };
+        ZSTD_inBuffer in;
+        size_t ret;
+
+        for (i = 0; i < used; i++) {
+            in.src = iov[i].iov_base;
+            in.size = iov[i].iov_len;
+            in.pos = 0;
+            ret = ZSTD_compressStream(p->zcs, &out, &in);
+            if (ZSTD_isError(ret) || in.pos != in.size) {
+                error_setg(errp, "multifd %d: zstd compressStream failed: %s",
+                           p->id, ZSTD_isError(ret) ? ZSTD_getErrorName(ret)
+                                                   : "output buffer full");
+                return -1;
+            }
+        }
+        ret = ZSTD_flushStream(p->zcs, &out);
+        if (ret) {
+            error_setg(errp, "multifd %d: zstd flushStream failed: %s",
+                       p->id, ZSTD_isError(ret) ? ZSTD_getErrorName(ret)
+                                               : "output buffer full");
+            return -1;
+        }
+        return out.pos;
+    }
+#endif
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static int multifd_recv_compress_setup(MultiFDRecvParams *p, Error **errp)
+{
+    p->compression = migrate_multifd_compression();
+    if (p->compression == MULTIFD_COMPRESSION_NONE) {
+        return 0;
+    }
+
+    p->zbuff_len = migrate_multifd_page_count() * TARGET_PAGE_SIZE * 2;
+    p->zbuff = g_try_malloc(p->zbuff_len);
+    if (!p->zbuff) {
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        if (inflateInit(&p->zs) != Z_OK) {
+            error_setg(errp, "multifd %d: inflate init failed: %s", p->id,
+                       p->zs.msg ? p->zs.msg : "unknown error");
+            return -1;
+        }
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD: {
+        size_t ret;
+
+        p->zds = ZSTD_createDStream();
+        if (!p->zds) {
+            error_setg(errp, "multifd %d: zstd createDStream failed", p->id);
+            return -1;
+        }
+        ret = ZSTD_initDStream(p->zds);
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: zstd initDStream failed: %s", p->id,
+                       ZSTD_getErrorName(ret));
+            return -1;
+        }
+        break;
+    }
+#endif
+    default:
+        g_assert_not_reached();
+    }
+    return 0;
+}
+
+static void multifd_recv_compress_cleanup(MultiFDRecvParams *p)
+{
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        inflateEnd(&p->zs);
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        ZSTD_freeDStream(p->zds);
+        p->zds = NULL;
+        break;
+#endif
+    default:
+        break;
+    }
+    g_free(p->zbuff);
+    p->zbuff = NULL;
+    p->zbuff_len = 0;
+}
+
+static int multifd_recv_uncompress(MultiFDRecvParams *p, uint32_t used,
+                                   uint32_t size, Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    uint32_t i;
+
+    switch (p->compression) {
+    case MULTIFD_COMPRESSION_ZLIB: {
+        z_stream *zs = &p->zs;
+
+        zs->next_in = p->zbuff;
+        zs->avail_in = size;
+        for (i = 0; i < used; i++) {
+            int flush = i == used - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+            int ret;
+
+            zs->next_out = iov[i].iov_base;
+            zs->avail_out = iov[i].iov_len;
+            ret = inflate(zs, flush);
+            if (ret != Z_OK || zs->avail_out) {
+                error_setg(errp, "multifd %d: inflate failed: %d", p->id, ret);
+                return -1;
+            }
+        }
+        return 0;
+    }
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD: {
+        ZSTD_inBuffer in = { .src = p->zbuff, .size = size };
+        ZSTD_outBuffer out;
+        size_t ret;
+
+        for (i = 0; i < used; i++) {
+            out.dst = iov[i].iov_base;
+            out.size = iov[i].iov_len;
+            out.pos = 0;
+            do {
+                ret = ZSTD_decompressStream(p->zds, &out, &in);
+            } while (ret > 0 && !ZSTD_isError(ret) && in.pos < in.size &&
+                     out.pos < out.size);
+            if (ZSTD_isError(ret) || out.pos != out.size) {
+                error_setg(errp, "multifd %d: zstd decompressStream failed: "
+                           "%s", p->id, ZSTD_isError(ret) ?
+                           ZSTD_getErrorName(ret) : "truncated packet");
+                return -1;
+            }
+        }
+        return 0;
+    }
+#endif
+    default:
+        g_assert_not_reached();
+    }
+}
+
 static void multifd_send_fill_packet(MultiFDSendParams *p)
 {
     MultiFDPacket_t *packet = p->packet;
@@ -717,9 +1020,11 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
     packet->magic = cpu_to_be32(MULTIFD_MAGIC);
     packet->version = cpu_to_be32(MULTIFD_VERSION);
-    packet->flags = cpu_to_be32(p->flags);
+    packet->flags = cpu_to_be32(p->flags |
+                                multifd_compression_flag(p->compression));
     packet->size = cpu_to_be32(migrate_multifd_page_count());
     packet->used = cpu_to_be32(p->pages->used);
+    packet->next_packet_size = 0;
     packet->packet_num = cpu_to_be64(p->packet_num);
 
     if (p->pages->block) {
@@ -754,6 +1059,14 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->flags = be32_to_cpu(packet->flags);
+    if ((p->flags & MULTIFD_FLAG_COMPRESSION_MASK) !=
+        multifd_compression_flag(p->compression)) {
+        error_setg(errp, "multifd: received packet "
+                   "compression flag %x and expected compression flag %x",
+                   p->flags & MULTIFD_FLAG_COMPRESSION_MASK,
+                   multifd_compression_flag(p->compression));
+        return -1;
+    }
 
     packet->size = be32_to_cpu(packet->size);
     if (packet->size > migrate_multifd_page_count()) {
@@ -771,6 +1084,14 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    packet->next_packet_size = be32_to_cpu(packet->next_packet_size);
+    if (packet->next_packet_size > p->zbuff_len) {
+        error_setg(errp, "multifd: received packet "
+                   "with compressed size %d and expected maximum size %d",
+                   packet->next_packet_size, p->zbuff_len);
+        return -1;
+    }
+
     p->packet_num = be64_to_cpu(packet->packet_num);
 
     if (p->pages->used) {
@@ -943,6 +1264,7 @@ void multifd_save_cleanup(void)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        multifd_send_compress_cleanup(p);
     }
     qemu_sem_destroy(&multifd_send_state->channels_ready);
     qemu_sem_destroy(&multifd_send_state->sem_sync);
@@ -995,6 +1317,10 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
+    if (multifd_send_compress_setup(p, &local_err) < 0) {
+        goto out;
+    }
+
     if (multifd_send_initial_packet(p, &local_err) < 0) {
         goto out;
     }
@@ -1009,6 +1335,7 @@ static void *multifd_send_thread(void *opaque)
             uint32_t used = p->pages->used;
             uint64_t packet_num = p->packet_num;
             uint32_t flags = p->flags;
+            int next_packet_size = 0;
 
             multifd_send_fill_packet(p);
             p->flags = 0;
@@ -1019,13 +1346,28 @@ static void *multifd_send_thread(void *opaque)
 
             trace_multifd_send(p->id, packet_num, used, flags);
 
+            if (used && p->compression != MULTIFD_COMPRESSION_NONE) {
+                next_packet_size = multifd_send_compress(p, used, &local_err);
+                if (next_packet_size < 0) {
+                    break;
+                }
+                p->packet->next_packet_size = cpu_to_be32(next_packet_size);
+                trace_multifd_send_compress(p->id, used, next_packet_size);
+            }
+
             ret = qio_channel_write_all(p->c, (void *)p->packet,
                                         p->packet_len, &local_err);
             if (ret != 0) {
                 break;
             }
 
-            ret = qio_channel_writev_all(p->c, p->pages->iov, used, &local_err);
+            if (next_packet_size) {
+                ret = qio_channel_write_all(p->c, (void *)p->zbuff,
+                                            next_packet_size, &local_err);
+            } else {
+                ret = qio_channel_writev_all(p->c, p->pages->iov, used,
+                                             &local_err);
+            }
             if (ret != 0) {
                 break;
             }
@@ -1181,6 +1523,7 @@ int multifd_load_cleanup(Error **errp)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        multifd_recv_compress_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
     g_free(multifd_recv_state->params);
@@ -1227,9 +1570,14 @@ static void *multifd_recv_thread(void *opaque)
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+    if (multifd_recv_compress_setup(p, &local_err) < 0) {
+        goto out;
+    }
+
     while (true) {
         uint32_t used;
         uint32_t flags;
+        uint32_t next_packet_size;
 
         ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
                                        p->packet_len, &local_err);
@@ -1249,12 +1597,29 @@ static void *multifd_recv_thread(void *opaque)
 
         used = p->pages->used;
         flags = p->flags;
+        next_packet_size = p->packet->next_packet_size;
         trace_multifd_recv(p->id, p->packet_num, used, flags);
         p->num_packets++;
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
-        ret = qio_channel_readv_all(p->c, p->pages->iov, used, &local_err);
+        if (next_packet_size) {
+            ret = qio_channel_read_all(p->c, (void *)p->zbuff,
+                                       next_packet_size, &local_err);
+            if (ret != 0) {
+                break;
+            }
+            trace_multifd_recv_uncompress(p->id, used, next_packet_size);
+            ret = multifd_recv_uncompress(p, used, next_packet_size,
+                                          &local_err);
+        } else if (used && p->compression != MULTIFD_COMPRESSION_NONE) {
+            error_setg(&local_err, "multifd %d: compressed packet "
+                       "without data", p->id);
+            break;
+        } else {
+            ret = qio_channel_readv_all(p->c, p->pages->iov, used,
+                                        &local_err);
+        }
         if (ret != 0) {
             break;
         }
@@ -1265,6 +1630,7 @@ static void *multifd_recv_thread(void *opaque)
         }
     }
 
+out:
     if (local_err) {
         multifd_recv_terminate_threads(local_err);
     }
@@ -1580,6 +1946,49 @@ static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
                                               &rs->num_dirty_pages_period);
 }
 
+typedef struct {
+    RAMState *rs;
+    RAMBlock *block;
+} DirtyRingSyncState;
+
+static void migration_bitmap_sync_ring_page(ram_addr_t addr, void *opaque)
+{
+    DirtyRingSyncState *s = opaque;
+    RAMBlock *block = s->block;
+
+    if (!block || addr - block->offset >= block->used_length) {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            if (addr - block->offset < block->used_length) {
+                break;
+            }
+        }
+        if (!block) {
+            /* Not migrated, leave it alone as the full scan does */
+            return;
+        }
+        s->block = block;
+    }
+
+    s->rs->migration_dirty_pages +=
+        cpu_physical_memory_sync_dirty_page(block, addr - block->offset,
+                                            &s->rs->num_dirty_pages_period);
+}
+
+/* Sync only the pages queued in the TCG dirty rings.  Returns false if the
+ * rings are disabled or missed some pages, and the whole dirty bitmap has to
+ * be scanned.
+ */
+static bool migration_bitmap_sync_ring(RAMState *rs)
+{
+    DirtyRingSyncState s = { .rs = rs };
+
+    if (!tcg_dirty_ring_size) {
+        return false;
+    }
+    return cpu_physical_memory_dirty_ring_collect(
+        migration_bitmap_sync_ring_page, &s);
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1664,8 +2073,10 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     rcu_read_lock();
-    RAMBLOCK_FOREACH_MIGRATABLE(block) {
-        migration_bitmap_sync_range(rs, block, 0, block->used_length);
+    if (!migration_bitmap_sync_ring(rs)) {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            migration_bitmap_sync_range(rs, block, 0, block->used_length);
+        }
     }
     ram_counters.remaining = ram_bytes_remaining();
     rcu_read_unlock();
@@ -37,6 +37,7 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                mem-hugepages=on|off back guest memory with transparent hugepages (default: on)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
     "                aes-key-wrap=on|off controls support for AES key wrapping (default=on)\n"
     "                dea-key-wrap=on|off controls support for DEA key wrapping (default=on)\n"
@@ -85,6 +86,14 @@ Include guest memory in a core dump. The default is on.
 Enables or disables memory merge support. This feature, when supported by
 the host, de-duplicates identical memory pages among VMs instances
 (enabled by default).
+@item mem-hugepages=on|off
+Enables or disables transparent hugepages for guest memory, with
+@code{madvise()}. Hugepages make the guest faster, but every page that the
+guest touches costs 2 MiB of host memory on x86 hosts, and every write after
+a @code{fork()} of QEMU copies a whole hugepage. Guests that touch little of
+their memory, or QEMU processes that are forked, can use less memory and
+start faster with hugepages off. Use @option{-mem-path} on a hugetlbfs mount
+for explicit hugepages. The default is on.
 @item aes-key-wrap=on|off
 Enables or disables AES key wrapping support on s390-ccw hosts. This feature
 controls whether AES wrapping keys will be created to allow
@@ -118,9 +127,10 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,dirty-ring-size=n]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                dirty-ring-size=n (record dirtied pages in per-vCPU rings, TCG only)\n", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -134,6 +144,12 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item dirty-ring-size=@var{n}
+Record the guest pages dirtied by each vCPU in a ring of @var{n} entries, so
+that migration only visits the pages that were written since the last dirty
+bitmap sync instead of scanning the dirty bitmap of all of guest RAM. When a
+ring fills up, the next sync falls back to the full scan. @var{n} must be a
+power of 2. The default is 0, which disables the rings.
 @end table
 ETEXI
 
@@ -790,7 +806,8 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][,index=i]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,snapshot=on|off][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -858,7 +875,8 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native", or "io_uring" and selects between pthread
+based disk I/O, native Linux AIO, and Linux io_uring.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
@@ -3016,6 +3034,13 @@ DEF("aflPanicAddr", HAS_ARG, QEMU_OPTION_aflPanicAddr, \
     "-aflPanicAddr hexaddr  Address of OS panic function\n", QEMU_ARCH_ALL)
 DEF("aflDmesgAddr", HAS_ARG, QEMU_OPTION_aflDmesgAddr, \
     "-aflDmesgAddr hexaddr  Address of OS logging function\n", QEMU_ARCH_ALL)
+DEF("aflFuzzClock", HAS_ARG, QEMU_OPTION_aflFuzzClock, \
+    "-aflFuzzClock ns  Advance the guest timebase by ns per executed block\n"
+    "                  instead of following the host clock (PPC only)\n",
+    QEMU_ARCH_PPC)
+DEF("aflIdleWarp", 0, QEMU_OPTION_aflIdleWarp, \
+    "-aflIdleWarp     Skip the virtual clock to the next timer deadline\n"
+    "                 whenever all vCPUs are idle\n", QEMU_ARCH_ALL)
 
 DEF("serial", HAS_ARG, QEMU_OPTION_serial, \
     "-serial dev     redirect the serial port to char device 'dev'\n",
@@ -3450,6 +3475,18 @@ STEXI
 Start right away with a saved state (@code{loadvm} in monitor)
 ETEXI
 
+DEF("loadvm-mapped", HAS_ARG, QEMU_OPTION_loadvm_mapped, \
+    "-loadvm-mapped file\n" \
+    "                start right away with a state saved by savevm_mapped\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -loadvm-mapped @var{file}
+@findex -loadvm-mapped
+Start right away with the state saved to @var{file} by @code{savevm_mapped}
+in the monitor.  Guest RAM is mapped copy-on-write from @var{file}, so
+pages are only read when the guest touches them.
+ETEXI
+
 #ifndef _WIN32
 DEF("daemonize", 0, QEMU_OPTION_daemonize, \
     "-daemonize      daemonize QEMU after initializing\n", QEMU_ARCH_ALL)
@@ -3508,12 +3545,12 @@ re-inject them.
 ETEXI
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay|record-fork,rrfile=<filename>,rrsnapshot=<snapshot>,rrbuf=<size>]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping\n", QEMU_ARCH_ALL)
 STEXI
-@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename},rrsnapshot=@var{snapshot}]
+@item -icount [shift=@var{N}|auto][,rr=record|replay|record-fork,rrfile=@var{filename},rrsnapshot=@var{snapshot},rrbuf=@var{size}]
 @findex -icount
 Enable virtual instruction counter.  The virtual cpu will execute one
 instruction every 2^@var{N} ns of virtual time.  If @code{auto} is specified
@@ -3550,6 +3587,16 @@ read from this file in replay mode.
 Option rrsnapshot is used to create new vm snapshot named @var{snapshot}
 at the start of execution recording. In replay mode this option is used
 to load the initial VM state.
+
+With @option{rr=record-fork}, nothing is recorded until the AFL fork server
+starts. The fork server saves a mapped snapshot of the VM into
+@var{filename}.snap, and every child records its execution into a buffer of
+@var{size} bytes in memory (64M by default). The log is written into
+@var{filename}.@var{pid} only when the child crashes, and is replayed from
+the fork server snapshot with
+@code{-loadvm-mapped @var{filename}.snap -icount ...,rr=replay,rrfile=@var{filename}.@var{pid}}.
+The fuzzing input read by the guest is part of the log. A child whose log
+does not fit in the buffer can't be replayed.
 ETEXI
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
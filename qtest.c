@@ -647,6 +647,30 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
 
         qtest_send_prefix(chr);
         qtest_sendf(chr, "OK %"PRIu64"\n", res);
+    } else if (strcmp(words[0], "hcall") == 0) {
+        uint64_t opcode, res, args[9];
+        uint32_t nargs, i;
+        GString *rsp;
+        int rc;
+
+        g_assert(words[1]);
+        rc = qemu_strtou64(words[1], NULL, 0, &opcode);
+        g_assert(rc == 0);
+        for (nargs = 0; words[nargs + 2]; nargs++) {
+            g_assert(nargs < ARRAY_SIZE(args));
+            rc = qemu_strtou64(words[nargs + 2], NULL, 0, &args[nargs]);
+            g_assert(rc == 0);
+        }
+        res = qtest_hcall(opcode, nargs, args);
+
+        rsp = g_string_new(NULL);
+        g_string_printf(rsp, "OK %"PRIu64, res);
+        for (i = 0; i < nargs; i++) {
+            g_string_append_printf(rsp, " 0x%"PRIx64, args[i]);
+        }
+        qtest_send_prefix(chr);
+        qtest_sendf(chr, "%s\n", rsp->str);
+        g_string_free(rsp, true);
 #endif
     } else if (qtest_enabled() && strcmp(words[0], "clock_step") == 0) {
         int64_t ns;
@@ -0,0 +1,167 @@
+/*
+ * replay-fork.c
+ *
+ * Recording from the AFL fork server
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * With rr=record-fork nothing is written while the VM boots.  The fork
+ * server saves a mapped snapshot of the VM before the first fork, and each
+ * child records its events into a buffer in memory, starting from that
+ * snapshot.  The buffer is written to <rrfile>.<pid> only if the child
+ * crashes, and can then be replayed without AFL with
+ *
+ *   -loadvm-mapped <rrfile>.snap -icount ...,rr=replay,rrfile=<rrfile>.<pid>
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+#include "migration/snapshot.h"
+#include "qemu/error-report.h"
+
+/* Prefix of the snapshot and log file names */
+static char *fork_filename;
+static uint64_t fork_buf_size;
+
+/* In-memory log of a child, and where it is saved if the child crashes */
+static char *fork_buf;
+static char *fork_log_filename;
+static bool fork_log_saved;
+
+void replay_fork_configure(const char *fname, uint64_t size)
+{
+    fork_filename = g_strdup(fname);
+    fork_buf_size = size;
+}
+
+void replay_fork_prepare(void)
+{
+    Error *err = NULL;
+    char *snapshot;
+
+    if (!fork_filename) {
+        return;
+    }
+
+    g_assert(replay_mutex_locked());
+
+    /* Nothing was recorded up to here, the logs start at this step */
+    replay_state.current_step = replay_get_current_step();
+
+    /* The vCPU threads have already left the execution loop, so the VM
+       can't be stopped the usual way. */
+    snapshot = g_strdup_printf("%s.snap", fork_filename);
+    if (save_mapped_snapshot_nostop(snapshot, &err) != 0) {
+        error_report_err(err);
+        error_report("Could not create snapshot for icount record");
+        exit(1);
+    }
+    g_free(snapshot);
+}
+
+static void replay_fork_crash(int sig)
+{
+    replay_fork_save_log();
+    /* The handler was reset, let the child die as it would have */
+    raise(sig);
+}
+
+void replay_fork_start(void)
+{
+    static const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    struct sigaction act;
+    int i;
+
+    if (!fork_filename) {
+        return;
+    }
+
+    fork_buf = g_malloc(fork_buf_size);
+    replay_file = fmemopen(fork_buf, fork_buf_size, "wb");
+    if (!replay_file) {
+        error_report("Replay: could not open the log buffer: %s",
+                     strerror(errno));
+        exit(1);
+    }
+    /* Unbuffered, so that the crash handler finds every event in fork_buf */
+    setvbuf(replay_file, NULL, _IONBF, 0);
+    replay_write_offset = 0;
+    replay_write_failed = false;
+    fork_log_filename = g_strdup_printf("%s.%d", fork_filename, getpid());
+
+    replay_put_dword(REPLAY_VERSION);
+    replay_put_qword(REPLAY_HEADER_FORK);
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = replay_fork_crash;
+    act.sa_flags = SA_RESETHAND;
+    for (i = 0; i < ARRAY_SIZE(signals); i++) {
+        sigaction(signals[i], &act, NULL);
+    }
+}
+
+/*
+ * Called from the crash signal handlers, so only async-signal-safe calls
+ * are allowed: replay_file is not touched, its length and error state are
+ * taken from replay_write_offset and replay_write_failed.
+ */
+void replay_fork_save_log(void)
+{
+    /* The instructions executed since the last event are not in the log
+       yet.  Nothing else can happen before the crash, so let replay run
+       freely after the last event. */
+    static const uint8_t tail[] = {
+        EVENT_INSTRUCTION, 0x7f, 0xff, 0xff, 0xff, EVENT_END
+    };
+    static const char overflow[] =
+        "Replay: the log buffer overflowed, crash log not saved\n";
+    size_t len = replay_write_offset;
+    int fd;
+
+    if (!fork_buf || !replay_file || fork_log_saved) {
+        return;
+    }
+    fork_log_saved = true;
+
+    if (replay_write_failed) {
+        if (write(STDERR_FILENO, overflow, sizeof(overflow) - 1) < 0) {
+            /* nothing else to do */
+        }
+        return;
+    }
+
+    fd = open(fork_log_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    if (qemu_write_full(fd, fork_buf, len) != len ||
+        qemu_write_full(fd, tail, sizeof(tail)) != sizeof(tail)) {
+        unlink(fork_log_filename);
+    }
+    close(fd);
+}
+
+void replay_fuzz_input(uint8_t **buf, size_t *size)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        g_assert(replay_mutex_locked());
+        replay_save_instructions();
+        replay_put_event(EVENT_FUZZ_INPUT);
+        replay_put_array(*buf, *size);
+    } else if (replay_mode == REPLAY_MODE_PLAY) {
+        g_assert(replay_mutex_locked());
+        replay_account_executed_instructions();
+        if (replay_next_event_is(EVENT_FUZZ_INPUT)) {
+            g_free(*buf);
+            replay_get_array_alloc(buf, size);
+            replay_finish_event();
+        } else {
+            error_report("Missing fuzzing input event in the replay log");
+            exit(1);
+        }
+    }
+}
@@ -24,14 +24,15 @@
 static QemuMutex lock;
 
 /* File for replay writing */
-static bool write_error;
 FILE *replay_file;
+size_t replay_write_offset;
+bool replay_write_failed;
 
 static void replay_write_error(void)
 {
-    if (!write_error) {
+    if (!replay_write_failed) {
         error_report("replay write error");
-        write_error = true;
+        replay_write_failed = true;
     }
 }
 
@@ -46,6 +47,8 @@ void replay_put_byte(uint8_t byte)
     if (replay_file) {
         if (putc(byte, replay_file) == EOF) {
             replay_write_error();
+        } else {
+            replay_write_offset++;
         }
     }
 }
@@ -78,8 +81,12 @@ void replay_put_qword(int64_t qword)
 void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
+        size_t written;
+
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
+        written = fwrite(buf, 1, size, replay_file);
+        replay_write_offset += written;
+        if (written != size) {
             replay_write_error();
         }
     }
@@ -12,6 +12,17 @@
  *
  */
 
+/* Current version of the replay mechanism.
+   Increase it when file format changes. */
+#define REPLAY_VERSION              0xe02008
+/* Size of replay log header */
+#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+/* Header flag of the logs recorded in the AFL fork server children */
+#define REPLAY_HEADER_FORK          1
+
+/* Default size of the in-memory log of the fork server children */
+#define REPLAY_FORK_BUF_SIZE        (64 * MiB)
+
 /* Any changes to order/number of events will need to bump REPLAY_VERSION */
 enum ReplayEvents {
     /* for instruction event */
@@ -34,6 +45,8 @@ enum ReplayEvents {
     EVENT_AUDIO_OUT,
     /* for audio in event */
     EVENT_AUDIO_IN,
+    /* for fuzzing input read by the guest */
+    EVENT_FUZZ_INPUT,
     /* for clock read/writes */
     /* some of greater codes are reserved for clocks */
     EVENT_CLOCK,
@@ -91,6 +104,10 @@ extern ReplayState replay_state;
 
 /* File for replay writing */
 extern FILE *replay_file;
+/* Bytes written to replay_file and whether a write failed, kept outside
+   of the FILE so that the fork crash handler can read them */
+extern size_t replay_write_offset;
+extern bool replay_write_failed;
 
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
@@ -183,6 +200,12 @@ void replay_event_net_save(void *opaque);
 /*! Reads network from the file. */
 void *replay_event_net_load(void);
 
+/* AFL fork server */
+
+/*! Enables recording from the fork server into logs named
+    <fname>.<pid>, with a buffer of the specified size. */
+void replay_fork_configure(const char *fname, uint64_t size);
+
 /* VMState-related functions */
 
 /* Registers replay VMState.
@@ -24,7 +24,9 @@
 static int replay_pre_save(void *opaque)
 {
     ReplayState *state = opaque;
-    state->file_offset = ftell(replay_file);
+    /* The fork server saves its snapshot before any log is open; the
+       logs of its children start right after the header. */
+    state->file_offset = replay_file ? ftell(replay_file) : HEADER_SIZE;
     state->host_clock_last = qemu_clock_get_last(QEMU_CLOCK_HOST);
 
     return 0;
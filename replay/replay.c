@@ -10,6 +10,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/replay.h"
 #include "replay-internal.h"
@@ -20,17 +21,13 @@
 #include "sysemu/sysemu.h"
 #include "qemu/error-report.h"
 
-/* Current version of the replay mechanism.
-   Increase it when file format changes. */
-#define REPLAY_VERSION              0xe02007
-/* Size of replay log header */
-#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
-
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
 
 /* Name of replay file  */
 static char *replay_filename;
+/* Flags from the header of the replayed log */
+static uint64_t replay_header_flags;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
@@ -262,13 +259,16 @@ static void replay_enable(const char *fname, int mode)
 
     atexit(replay_finish);
 
-    replay_file = fopen(fname, fmode);
-    if (replay_file == NULL) {
-        fprintf(stderr, "Replay: open %s: %s\n", fname, strerror(errno));
-        exit(1);
+    /* Without a file name, the log is opened later by replay_fork_start */
+    if (fname) {
+        replay_file = fopen(fname, fmode);
+        if (replay_file == NULL) {
+            fprintf(stderr, "Replay: open %s: %s\n", fname, strerror(errno));
+            exit(1);
+        }
+        replay_filename = g_strdup(fname);
     }
 
-    replay_filename = g_strdup(fname);
     replay_mode = mode;
     replay_mutex_init();
 
@@ -279,13 +279,16 @@ static void replay_enable(const char *fname, int mode)
 
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        if (replay_file) {
+            fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        }
     } else if (replay_mode == REPLAY_MODE_PLAY) {
         unsigned int version = replay_get_dword();
         if (version != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
+        replay_header_flags = replay_get_qword();
         /* go to the beginning */
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
         replay_fetch_data_kind();
@@ -299,6 +302,7 @@ void replay_configure(QemuOpts *opts)
     const char *fname;
     const char *rr;
     ReplayMode mode = REPLAY_MODE_NONE;
+    bool fork_mode = false;
     Location loc;
 
     if (!opts) {
@@ -316,6 +320,9 @@ void replay_configure(QemuOpts *opts)
         mode = REPLAY_MODE_RECORD;
     } else if (!strcmp(rr, "replay")) {
         mode = REPLAY_MODE_PLAY;
+    } else if (!strcmp(rr, "record-fork")) {
+        mode = REPLAY_MODE_RECORD;
+        fork_mode = true;
     } else {
         error_report("Invalid icount rr option: %s", rr);
         exit(1);
@@ -328,6 +335,16 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    if (fork_mode) {
+        if (replay_snapshot) {
+            error_report("rrsnapshot can't be used with rr=record-fork");
+            exit(1);
+        }
+        /* Only the fork server children record, each into its own log */
+        replay_fork_configure(fname, qemu_opt_get_size(opts, "rrbuf",
+                                                       REPLAY_FORK_BUF_SIZE));
+        fname = NULL;
+    }
     replay_vmstate_register();
     replay_enable(fname, mode);
 
@@ -388,6 +405,11 @@ void replay_finish(void)
     replay_finish_events();
 }
 
+bool replay_is_fork_log(void)
+{
+    return replay_header_flags & REPLAY_HEADER_FORK;
+}
+
 void replay_add_blocker(Error *reason)
 {
     replay_blockers = g_slist_prepend(replay_blockers, reason);
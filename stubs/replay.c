@@ -80,3 +80,7 @@ void replay_mutex_lock(void)
 void replay_mutex_unlock(void)
 {
 }
+
+void replay_fuzz_input(uint8_t **buf, size_t *size)
+{
+}
@@ -1067,6 +1067,7 @@ struct CPUPPCState {
     /* Internal devices resources */
     /* Time base and decrementer */
     ppc_tb_t *tb_env;
+    uint64_t tb_deadline_ns;    /* Next decrementer expiry (fuzz clock) */
     /* Device control registers */
     ppc_dcr_t *dcr_env;
 
@@ -1313,6 +1314,11 @@ void cpu_ppc_store_decr (CPUPPCState *env, uint32_t value);
 uint32_t cpu_ppc_load_hdecr (CPUPPCState *env);
 void cpu_ppc_store_hdecr (CPUPPCState *env, uint32_t value);
 uint64_t cpu_ppc_load_purr (CPUPPCState *env);
+#if !defined(CONFIG_USER_ONLY)
+void cpu_ppc_fuzz_clock_tick(CPUPPCState *env);
+void cpu_ppc_fuzz_clock_expire(CPUPPCState *env);
+void cpu_ppc_fuzz_clock_idle(CPUPPCState *env);
+#endif
 uint32_t cpu_ppc601_load_rtcl (CPUPPCState *env);
 uint32_t cpu_ppc601_load_rtcu (CPUPPCState *env);
 #if !defined(CONFIG_USER_ONLY)
@@ -26,6 +26,7 @@
 #include "tcg.h"
 #include "internal.h"
 #include "qemu/atomic128.h"
+#include "qemu/cutils.h"
 
 //#define DEBUG_OP
 
@@ -54,13 +55,95 @@ static inline target_ulong addr_add(CPUPPCState *env, target_ulong addr,
     }
 }
 
+#if !defined(CONFIG_USER_ONLY)
+/* Fill the TLB for a single-page access of @nb bytes at @addr and return
+ * the host address backing it, or NULL if the page is not plain RAM
+ * (MMIO, watchpoints, not-dirty code pages, ...).
+ */
+static void *probe_page(CPUPPCState *env, target_ulong addr, uint32_t nb,
+                        MMUAccessType access_type, int mmu_idx,
+                        uintptr_t raddr)
+{
+    void *host = tlb_vaddr_to_host(env, addr, access_type, mmu_idx);
+
+    if (unlikely(!host)) {
+        if (access_type == MMU_DATA_STORE) {
+            probe_write(env, addr, nb, mmu_idx, raddr);
+        } else {
+            probe_read(env, addr, nb, mmu_idx, raddr);
+        }
+        host = tlb_vaddr_to_host(env, addr, access_type, mmu_idx);
+    }
+    return host;
+}
+#endif
+
+/* Return a host pointer covering the @nb bytes at @addr, filling the
+ * TLB for every page touched (and so raising any fault exactly as the
+ * first real access would), or NULL if some of the range is not plain
+ * RAM or the pages are not contiguous on the host.  In the latter case
+ * the caller must fall back to per-element accesses.
+ */
+static void *probe_contiguous(CPUPPCState *env, target_ulong addr, uint32_t nb,
+                              MMUAccessType access_type, int mmu_idx,
+                              uintptr_t raddr)
+{
+#if defined(CONFIG_USER_ONLY)
+    return NULL;
+#else
+    void *host1, *host2;
+    uint32_t nb_pg1, nb_pg2;
+
+    if (unlikely(nb == 0)) {
+        return NULL;
+    }
+
+    nb_pg1 = -(addr | TARGET_PAGE_MASK);
+    if (likely(nb <= nb_pg1)) {
+        /* The entire operation is on a single page.  */
+        return probe_page(env, addr, nb, access_type, mmu_idx, raddr);
+    }
+
+    /* The operation spans two pages.  */
+    nb_pg2 = nb - nb_pg1;
+    host1 = probe_page(env, addr, nb_pg1, access_type, mmu_idx, raddr);
+    addr = addr_add(env, addr, nb_pg1);
+    host2 = probe_page(env, addr, nb_pg2, access_type, mmu_idx, raddr);
+
+    /* If the two host pages are contiguous, optimize.  */
+    if (host1 && host2 == host1 + nb_pg1) {
+        return host1;
+    }
+    return NULL;
+#endif
+}
+
 void helper_lmw(CPUPPCState *env, target_ulong addr, uint32_t reg)
 {
+    uintptr_t raddr = GETPC();
+    int mmu_idx = cpu_mmu_index(env, false);
+    void *host = probe_contiguous(env, addr, (32 - reg) * 4,
+                                  MMU_DATA_LOAD, mmu_idx, raddr);
+
+    if (likely(host)) {
+        /* Fast path -- the entire operation is in RAM at host.  */
+        for (; reg < 32; reg++) {
+            if (needs_byteswap(env)) {
+                env->gpr[reg] = bswap32(ldl_p(host));
+            } else {
+                env->gpr[reg] = (uint32_t)ldl_p(host);
+            }
+            host += 4;
+        }
+        return;
+    }
+
+    /* Slow path -- at least some of the operation requires i/o.  */
     for (; reg < 32; reg++) {
         if (needs_byteswap(env)) {
-            env->gpr[reg] = bswap32(cpu_ldl_data_ra(env, addr, GETPC()));
+            env->gpr[reg] = bswap32(cpu_ldl_data_ra(env, addr, raddr));
         } else {
-            env->gpr[reg] = cpu_ldl_data_ra(env, addr, GETPC());
+            env->gpr[reg] = cpu_ldl_data_ra(env, addr, raddr);
         }
         addr = addr_add(env, addr, 4);
     }
@@ -68,12 +151,31 @@ void helper_lmw(CPUPPCState *env, target_ulong addr, uint32_t reg)
 
 void helper_stmw(CPUPPCState *env, target_ulong addr, uint32_t reg)
 {
+    uintptr_t raddr = GETPC();
+    int mmu_idx = cpu_mmu_index(env, false);
+    void *host = probe_contiguous(env, addr, (32 - reg) * 4,
+                                  MMU_DATA_STORE, mmu_idx, raddr);
+
+    if (likely(host)) {
+        /* Fast path -- the entire operation is in RAM at host.  */
+        for (; reg < 32; reg++) {
+            if (needs_byteswap(env)) {
+                stl_p(host, bswap32((uint32_t)env->gpr[reg]));
+            } else {
+                stl_p(host, (uint32_t)env->gpr[reg]);
+            }
+            host += 4;
+        }
+        return;
+    }
+
+    /* Slow path -- at least some of the operation requires i/o.  */
     for (; reg < 32; reg++) {
         if (needs_byteswap(env)) {
             cpu_stl_data_ra(env, addr, bswap32((uint32_t)env->gpr[reg]),
-                                                   GETPC());
+                                                   raddr);
         } else {
-            cpu_stl_data_ra(env, addr, (uint32_t)env->gpr[reg], GETPC());
+            cpu_stl_data_ra(env, addr, (uint32_t)env->gpr[reg], raddr);
         }
         addr = addr_add(env, addr, 4);
     }
@@ -82,8 +184,42 @@ void helper_stmw(CPUPPCState *env, target_ulong addr, uint32_t reg)
 static void do_lsw(CPUPPCState *env, target_ulong addr, uint32_t nb,
                    uint32_t reg, uintptr_t raddr)
 {
+    int mmu_idx;
+    void *host;
     int sh;
 
+    if (unlikely(nb == 0)) {
+        return;
+    }
+
+    mmu_idx = cpu_mmu_index(env, false);
+    host = probe_contiguous(env, addr, nb, MMU_DATA_LOAD, mmu_idx, raddr);
+
+    if (likely(host)) {
+        /* Fast path -- the entire operation is in RAM at host.  */
+        for (; nb > 3; nb -= 4) {
+            env->gpr[reg] = (uint32_t)ldl_p(host);
+            reg = (reg + 1) % 32;
+            host += 4;
+        }
+        switch (nb) {
+        default:
+            return;
+        case 1:
+            env->gpr[reg] = (uint32_t)ldub_p(host) << 24;
+            break;
+        case 2:
+            env->gpr[reg] = (uint32_t)lduw_p(host) << 16;
+            break;
+        case 3:
+            env->gpr[reg] = ((uint32_t)lduw_p(host) << 16) |
+                            (ldub_p(host + 2) << 8);
+            break;
+        }
+        return;
+    }
+
+    /* Slow path -- at least some of the operation requires i/o.  */
     for (; nb > 3; nb -= 4) {
         env->gpr[reg] = cpu_ldl_data_ra(env, addr, raddr);
         reg = (reg + 1) % 32;
@@ -127,16 +263,51 @@ void helper_lswx(CPUPPCState *env, target_ulong addr, uint32_t reg,
 void helper_stsw(CPUPPCState *env, target_ulong addr, uint32_t nb,
                  uint32_t reg)
 {
+    uintptr_t raddr = GETPC();
+    int mmu_idx;
+    void *host;
     int sh;
 
+    if (unlikely(nb == 0)) {
+        return;
+    }
+
+    mmu_idx = cpu_mmu_index(env, false);
+    host = probe_contiguous(env, addr, nb, MMU_DATA_STORE, mmu_idx, raddr);
+
+    if (likely(host)) {
+        /* Fast path -- the entire operation is in RAM at host.  */
+        for (; nb > 3; nb -= 4) {
+            stl_p(host, env->gpr[reg]);
+            reg = (reg + 1) % 32;
+            host += 4;
+        }
+        switch (nb) {
+        default:
+            break;
+        case 1:
+            stb_p(host, env->gpr[reg] >> 24);
+            break;
+        case 2:
+            stw_p(host, env->gpr[reg] >> 16);
+            break;
+        case 3:
+            stw_p(host, env->gpr[reg] >> 16);
+            stb_p(host + 2, env->gpr[reg] >> 8);
+            break;
+        }
+        return;
+    }
+
+    /* Slow path -- at least some of the operation requires i/o.  */
     for (; nb > 3; nb -= 4) {
-        cpu_stl_data_ra(env, addr, env->gpr[reg], GETPC());
+        cpu_stl_data_ra(env, addr, env->gpr[reg], raddr);
         reg = (reg + 1) % 32;
         addr = addr_add(env, addr, 4);
     }
     if (unlikely(nb > 0)) {
         for (sh = 24; nb > 0; nb--, sh -= 8) {
-            cpu_stb_data_ra(env, addr, (env->gpr[reg] >> sh) & 0xFF, GETPC());
+            cpu_stb_data_ra(env, addr, (env->gpr[reg] >> sh) & 0xFF, raddr);
             addr = addr_add(env, addr, 1);
         }
     }
@@ -167,10 +338,25 @@ static void dcbz_common(CPUPPCState *env, target_ulong addr,
         env->reserve_addr = (target_ulong)-1ULL;
     }
 
-    /* Try fast path translate */
+    /* Try fast path translate; on a TLB miss fill the entry once for
+     * the whole line rather than taking one slow store per doubleword.
+     */
     haddr = tlb_vaddr_to_host(env, addr, MMU_DATA_STORE, mmu_idx);
+#if !defined(CONFIG_USER_ONLY)
+    if (!haddr) {
+        probe_write(env, addr, dcbz_size, mmu_idx, retaddr);
+        haddr = tlb_vaddr_to_host(env, addr, MMU_DATA_STORE, mmu_idx);
+    }
+#endif
     if (haddr) {
-        memset(haddr, 0, dcbz_size);
+        /* Guests zero a lot of memory that is still zero, e.g. pages that
+         * were never touched since boot.  Don't write those: the host can
+         * keep them unallocated, or shared with the zero page.  This is
+         * only done for direct RAM, where nothing needs to see the store.
+         */
+        if (!buffer_is_zero(haddr, dcbz_size)) {
+            memset(haddr, 0, dcbz_size);
+        }
     } else {
         /* Slow path */
         for (i = 0; i < dcbz_size; i += 8) {
@@ -34,6 +34,7 @@
 #include "exec/translator.h"
 #include "exec/log.h"
 #include "qemu/atomic128.h"
+#include "sysemu/replay.h"
 
 
 #define CPU_SINGLE_STEP 0x1
@@ -3029,7 +3030,12 @@ static void gen_stswx(DisasContext *ctx)
 /* eieio */
 static void gen_eieio(DisasContext *ctx)
 {
-    TCGBar bar = TCG_MO_LD_ST;
+    /*
+     * eieio orders stores to cacheable memory and all accesses to
+     * caching-inhibited memory.  TCG cannot tell the two apart, and MMIO
+     * ordering matters once vCPUs run in parallel, so use a full barrier.
+     */
+    TCGBar bar = TCG_MO_ALL;
 
     /*
      * POWER9 has a eieio instruction variant using bit 6 as a hint to
@@ -3068,6 +3074,14 @@ static inline void gen_check_tlb_flush(DisasContext *ctx, bool global)
     tcg_gen_brcondi_i32(TCG_COND_EQ, t, 0, l);
     if (global) {
         gen_helper_check_tlb_flush_global(cpu_env);
+        /*
+         * A global flush is queued as safe work on this vCPU and only
+         * completes once it returns to the execution loop, so leave the
+         * TB, but only when a flush was actually pending.  The exclusive
+         * section that runs the flush also orders memory like a barrier.
+         */
+        gen_update_nip(ctx, ctx->base.pc_next);
+        tcg_gen_exit_tb(NULL, 0);
     } else {
         gen_helper_check_tlb_flush_local(cpu_env);
     }
@@ -3543,6 +3557,16 @@ static void gen_sync(DisasContext *ctx)
     if (((l == 2) || !(ctx->insns_flags & PPC_64B)) && !ctx->pr) {
         gen_check_tlb_flush(ctx, true);
     }
+
+    /*
+     * lwsync orders everything except a store followed by a load, which
+     * lets hosts with a strong memory model (x86) elide the barrier.
+     * CPUs without lwsync execute L=1 as a heavyweight sync.
+     */
+    if (l == 1 && (ctx->insns_flags & PPC_64B)) {
+        tcg_gen_mb(TCG_MO_LD_LD | TCG_MO_LD_ST | TCG_MO_ST_ST | TCG_BAR_SC);
+        return;
+    }
     tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
 }
 
@@ -6767,7 +6791,15 @@ static void gen_dform3D(DisasContext *ctx)
 /* handle AFL opcode */
 static void gen_afl(DisasContext *ctx)
 {
+    /* getWork saves the fuzzing input to the record/replay log */
+    if (tb_cflags(ctx->base.tb) & CF_USE_ICOUNT) {
+        gen_io_start();
+    }
     gen_helper_afl(cpu_env);
+    if (tb_cflags(ctx->base.tb) & CF_USE_ICOUNT) {
+        gen_io_end();
+        gen_stop_exception(ctx);
+    }
 }
 
 static void gen_aflbb(DisasContextBase *ctx)
@@ -7864,47 +7896,54 @@ void restore_state_to_opc(CPUPPCState *env, TranslationBlock *tb,
 
 static target_ulong startForkserver(CPUArchState *env, target_ulong enableTicks)
 {
+    CPUState *cs;
+
     printf("pid %d: startForkServer\n", getpid()); fflush(stdout);
     assert(!afl_fork_child);
     /*
-     * we're running in a cpu thread. we'll exit the cpu thread
+     * we're running in a cpu thread. we'll exit the cpu thread(s)
      * and notify the iothread.  The iothread will run the forkserver
-     * and in the child will restart the cpu thread which will continue
-     * execution.
-     * N.B. We assume a single cpu here!
+     * and in the child will restart the cpu thread(s) which will continue
+     * execution.  With MTTCG every vCPU thread has to notice, so kick
+     * them all out of the execution loop.
      */
     aflEnableTicks = enableTicks;
     afl_wants_cpu_to_stop = 1;
+    CPU_FOREACH(cs) {
+        qemu_cpu_kick(cs);
+    }
     return 0;
 }
 
 static target_ulong getWork(CPUArchState *env, target_ulong ptr, target_ulong sz)
 {
     target_ulong retsz;
-    FILE *fp;
-    unsigned char ch;
+    gchar *contents = NULL;
+    gsize len = 0;
+    uint8_t *buf;
+    size_t size;
+    GError *err = NULL;
 
     //printf("pid %d: getWork %lx %lx\n", getpid(), ptr, sz);fflush(stdout);
     assert(aflStart == 0);
 
-    if(!afl_attached()) {
-        return 0;
+    if(afl_attached()) {
+        if(!g_file_get_contents(aflFile, &contents, &len, &err)) {
+            fprintf(stderr, "%s\n", err->message);
+            g_error_free(err);
+            return -1;
+        }
     }
 
-    fp = fopen(aflFile, "rb");
-    if(!fp) {
-         perror(aflFile);
-         return -1;
-    }
-    retsz = 0;
-    while(retsz < sz) {
-        if(fread(&ch, 1, 1, fp) == 0)
-            break;
-        cpu_stb_data(env, ptr, ch);
-        retsz ++;
-        ptr ++;
+    /* record the input, so that a crash can be replayed without AFL */
+    buf = (uint8_t *)contents;
+    size = len;
+    replay_fuzz_input(&buf, &size);
+
+    for(retsz = 0; retsz < sz && retsz < size; retsz++) {
+        cpu_stb_data(env, ptr + retsz, buf[retsz]);
     }
-    fclose(fp);
+    g_free(buf);
     return retsz;
 }
 
@@ -7950,6 +7989,11 @@ void helper_afl(CPUPPCState *env)
 
 void helper_aflbb(CPUPPCState *env) {
         afl_maybe_log(env->nip);
+#if !defined(CONFIG_USER_ONLY)
+        if (aflFuzzClock) {
+            cpu_ppc_fuzz_clock_tick(env);
+        }
+#endif
         /*if(aflStart)
             fprintf(stderr, "tracing at " TARGET_FMT_lx "\n",env->nip);*/
 }
\ No newline at end of file
@@ -33,6 +33,7 @@
 #include "qemu/error-report.h"
 #include "qemu/cutils.h"
 #include "qemu/host-utils.h"
+#include "qemu/bitmap.h"
 #include "qemu/timer.h"
 
 /* Note: the long term plan is to reduce the dependencies on the QEMU
@@ -57,9 +58,6 @@
 # define ELF_DATA   ELFDATA2LSB
 #endif
 
-#define MAXCPUSHACK 4
-#define CONFIG_USER_ONLY1 1
-
 #include "elf.h"
 #include "exec/log.h"
 #include "sysemu/sysemu.h"
@@ -150,6 +148,9 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Once every region holds code, some can be handed back with
+ * tcg_region_evict() instead of flushing the whole buffer.
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -163,7 +164,12 @@ struct tcg_region_state {
     size_t stride; /* .size + guard size */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    unsigned long *in_use; /* regions that hold code */
+    uint64_t *gen; /* position of each region in the eviction order */
+    uint64_t next_gen;
+
+    /* set without the lock when a TB of the region is looked up */
+    bool *used;
     size_t agg_size_full; /* aggregate size of full regions */
 };
 
@@ -378,22 +384,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
     if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
     }
-    return region_trees + region_idx * tree_size;
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -528,11 +535,15 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t i = find_first_zero_bit(region.in_use, region.n);
+
+    if (i == region.n) {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    set_bit(i, region.in_use);
+    region.gen[i] = region.next_gen++;
+    atomic_set(&region.used[i], false);
+    tcg_region_assign(s, i);
     return false;
 }
 
@@ -571,7 +582,7 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
-    region.current = 0;
+    bitmap_zero(region.in_use, region.n);
     region.agg_size_full = 0;
 
     for (i = 0; i < n_ctxs; i++) {
@@ -585,7 +596,98 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
-#ifdef CONFIG_USER_ONLY1
+/*
+ * Note that the TB at @tc_ptr was looked up, so that its region gets a second
+ * chance when it is next picked for eviction.
+ */
+void tcg_region_mark_used(const void *tc_ptr)
+{
+    atomic_set(&region.used[tc_ptr_to_region_idx(tc_ptr)], true);
+}
+
+/*
+ * Evict up to @max_regions regions that are not being filled by a TCG
+ * context. Victims are picked in second-chance order: the oldest region
+ * goes, unless one of its TBs was looked up since it was last considered,
+ * in which case it moves to the back of the queue instead. @func is called
+ * for every TB of a victim region (with that region's tree locked), so that
+ * the caller can unlink it from the rest of the translated code; afterwards
+ * the region is free for reuse.
+ *
+ * Returns the number of regions evicted. Call from a safe-work context.
+ */
+size_t tcg_region_evict(size_t max_regions, GTraverseFunc func,
+                        gpointer user_data)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    unsigned long *busy = bitmap_new(region.n);
+    size_t evicted = 0;
+    unsigned int i;
+
+    qemu_mutex_lock(&region.lock);
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        set_bit(tc_ptr_to_region_idx(s->code_gen_buffer), busy);
+    }
+
+    while (evicted < max_regions) {
+        struct tcg_region_tree *rt;
+        size_t j, victim = region.n;
+        void *start, *end;
+
+        for (j = 0; j < region.n; j++) {
+            if (test_bit(j, region.in_use) && !test_bit(j, busy) &&
+                (victim == region.n || region.gen[j] < region.gen[victim])) {
+                victim = j;
+            }
+        }
+        if (victim == region.n) {
+            break;
+        }
+        if (atomic_read(&region.used[victim])) {
+            atomic_set(&region.used[victim], false);
+            region.gen[victim] = region.next_gen++;
+            continue;
+        }
+
+        rt = region_trees + victim * tree_size;
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, func, user_data);
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        tcg_region_bounds(victim, &start, &end);
+        region.agg_size_full -= end - start - TCG_HIGHWATER;
+        clear_bit(victim, region.in_use);
+        evicted++;
+    }
+
+    qemu_mutex_unlock(&region.lock);
+    g_free(busy);
+    return evicted;
+}
+
+size_t tcg_region_count(void)
+{
+    return region.n;
+}
+
+/* Returns true if a context could switch to a new region right now */
+bool tcg_region_available(void)
+{
+    bool ret;
+
+    qemu_mutex_lock(&region.lock);
+    ret = find_first_zero_bit(region.in_use, region.n) != region.n;
+    qemu_mutex_unlock(&region.lock);
+    return ret;
+}
+
+#ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
     return 1;
@@ -601,10 +703,19 @@ static size_t tcg_n_regions(void)
 {
     size_t i;
 
-    /* Use a single region if all we have is one vCPU thread */
-/*    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
+    /*
+     * A single vCPU thread only ever fills one region at a time, but we
+     * still split the buffer (into regions of at least 2 MB) so that a
+     * full cache can be recycled a few regions at a time.
+     */
+    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
+        for (i = 8; i > 1; i /= 2) {
+            if (tcg_init_ctx.code_gen_buffer_size / i >= 2 * 1024u * 1024) {
+                return i;
+            }
+        }
         return 1;
-    } */
+    }
 
     /* Try to have more regions than max_cpus, with each region being >= 2 MB */
     for (i = 8; i > 0; i--) {
@@ -612,14 +723,14 @@ static size_t tcg_n_regions(void)
         size_t region_size;
 
         region_size = tcg_init_ctx.code_gen_buffer_size;
-        region_size /= MAXCPUSHACK * regions_per_thread;
+        region_size /= max_cpus * regions_per_thread;
 
         if (region_size >= 2 * 1024u * 1024) {
-            return MAXCPUSHACK * regions_per_thread;
+            return max_cpus * regions_per_thread;
         }
     }
     /* If we can't, then just allocate one region per vCPU thread */
-    return MAXCPUSHACK;
+    return max_cpus;
 }
 #endif
 
@@ -634,7 +745,11 @@ static size_t tcg_n_regions(void)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG the regions are all filled, one
+ * after the other, by tcg_init_ctx: the single round-robin vCPU thread
+ * translates with the initial context, so that the thread restarted in an
+ * AFL forkserver child keeps using (and adding to) the code translated in
+ * the parent.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
@@ -699,16 +814,28 @@ void tcg_region_init(void)
         g_assert(!rc);
     }
 
+    region.in_use = bitmap_new(region.n);
+    region.gen = g_new0(uint64_t, region.n);
+    region.used = g_new0(bool, region.n);
+
     tcg_region_trees_init();
 
-    /* In user-mode we support only one ctx, so do the initial allocation now */
-#ifdef CONFIG_USER_ONLY1
+    /*
+     * In user-mode, and in softmmu without MTTCG, we support only one ctx,
+     * so do the initial allocation now.
+     */
+#ifndef CONFIG_USER_ONLY
+    if (qemu_tcg_mttcg_enabled()) {
+        return;
+    }
+    tcg_ctxs[0] = &tcg_init_ctx;
+    n_tcg_ctxs = 1;
+#endif
     {
         bool err = tcg_region_initial_alloc__locked(tcg_ctx);
 
         g_assert(!err);
     }
-#endif
 }
 
 /*
@@ -719,25 +846,45 @@ void tcg_region_init(void)
  * In user-mode we just point tcg_ctx to tcg_init_ctx. See the documentation
  * of tcg_region_init() for the reasoning behind this.
  *
- * In softmmu each caller registers its context in tcg_ctxs[]. Note that in
- * softmmu tcg_ctxs[] does not track tcg_ctx_init, since the initial context
- * is not used anymore for translation once this function is called.
+ * In softmmu with MTTCG each caller registers its context in tcg_ctxs[].
+ * Note that tcg_ctxs[] then does not track tcg_ctx_init, since the initial
+ * context is not used anymore for translation once this function is called.
  *
- * Not tracking tcg_init_ctx in tcg_ctxs[] in softmmu keeps code that iterates
- * over the array (e.g. tcg_code_size() the same for both softmmu and user-mode.
+ * Without MTTCG the single vCPU thread shares tcg_init_ctx, as in user-mode,
+ * and tcg_region_init() stores it in tcg_ctxs[0].  Code that iterates over
+ * the array (e.g. tcg_code_size()) thus sees exactly the contexts that
+ * translate, in user-mode and in both softmmu configurations.
+ *
+ * A thread restarted after tcg_reclaim_thread_contexts() takes over one of
+ * the contexts, and the region it was filling, left behind by a thread of
+ * the parent process rather than allocating a new one.
  */
-#ifdef CONFIG_USER_ONLY1
+#ifdef CONFIG_USER_ONLY
 void tcg_register_thread(void)
 {
     tcg_ctx = &tcg_init_ctx;
 }
 #else
+static unsigned int n_tcg_ctxs_bound;
+
 void tcg_register_thread(void)
 {
-    TCGContext *s = g_malloc(sizeof(*s));
+    TCGContext *s;
     unsigned int i, n;
     bool err;
 
+    if (!qemu_tcg_mttcg_enabled()) {
+        tcg_ctx = &tcg_init_ctx;
+        return;
+    }
+
+    n = atomic_fetch_inc(&n_tcg_ctxs_bound);
+    if (n < atomic_read(&n_tcg_ctxs)) {
+        tcg_ctx = atomic_read(&tcg_ctxs[n]);
+        return;
+    }
+
+    s = g_malloc(sizeof(*s));
     *s = tcg_init_ctx;
 
     /* Relink mem_base.  */
@@ -751,7 +898,7 @@ void tcg_register_thread(void)
 
     /* Claim an entry in tcg_ctxs */
     n = atomic_fetch_inc(&n_tcg_ctxs);
-    g_assert(n < MAXCPUSHACK);
+    g_assert(n < max_cpus);
     atomic_set(&tcg_ctxs[n], s);
 
     tcg_ctx = s;
@@ -760,6 +907,16 @@ void tcg_register_thread(void)
     g_assert(!err);
     qemu_mutex_unlock(&region.lock);
 }
+
+/*
+ * Called in a freshly forked child, whose only thread is the one that
+ * forked: the per-thread contexts of the parent's vCPU threads are still
+ * in memory, so hand them over to the vCPU threads about to be restarted.
+ */
+void tcg_reclaim_thread_contexts(void)
+{
+    atomic_set(&n_tcg_ctxs_bound, 0);
+}
 #endif /* !CONFIG_USER_ONLY */
 
 /*
@@ -819,6 +976,24 @@ size_t tcg_tb_phys_invalidate_count(void)
     return total;
 }
 
+void tcg_smc_counts(size_t *pwrites, size_t *pfiltered, size_t *pinval)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    unsigned int i;
+    size_t writes = 0, filtered = 0, inval = 0;
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        writes += atomic_read(&s->smc_write_count);
+        filtered += atomic_read(&s->smc_filtered_count);
+        inval += atomic_read(&s->smc_invalidate_count);
+    }
+    *pwrites = writes;
+    *pfiltered = filtered;
+    *pinval = inval;
+}
+
 /* pool based memory allocation */
 void *tcg_malloc_internal(TCGContext *s, int size)
 {
@@ -957,11 +1132,11 @@ void tcg_context_init(TCGContext *s)
      * reasoning behind this.
      * In softmmu we will have at most max_cpus TCG threads.
      */
-#ifdef CONFIG_USER_ONLY1
+#ifdef CONFIG_USER_ONLY
     tcg_ctxs = &tcg_ctx;
     n_tcg_ctxs = 1;
 #else
-    tcg_ctxs = g_new(TCGContext *, MAXCPUSHACK);
+    tcg_ctxs = g_new(TCGContext *, max_cpus);
 #endif
 
     tcg_debug_assert(!tcg_regset_test_reg(s->reserved_regs, TCG_AREG0));
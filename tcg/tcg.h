@@ -703,6 +703,12 @@ struct TCGContext {
 
     size_t tb_phys_invalidate_count;
 
+    /* Writes to pages holding translated code, see
+       tb_invalidate_phys_page_fast() */
+    size_t smc_write_count;
+    size_t smc_filtered_count;
+    size_t smc_invalidate_count;
+
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
@@ -872,6 +878,11 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
+void tcg_region_mark_used(const void *tc_ptr);
+size_t tcg_region_evict(size_t max_regions, GTraverseFunc func,
+                        gpointer user_data);
+size_t tcg_region_count(void);
+bool tcg_region_available(void);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -879,6 +890,7 @@ size_t tcg_code_capacity(void);
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
 size_t tcg_tb_phys_invalidate_count(void);
+void tcg_smc_counts(size_t *pwrites, size_t *pfiltered, size_t *pinval);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
@@ -904,6 +916,7 @@ static inline void *tcg_malloc(int size)
 
 void tcg_context_init(TCGContext *s);
 void tcg_register_thread(void);
+void tcg_reclaim_thread_contexts(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
@@ -0,0 +1,141 @@
+/*
+ * Dirty bitmap scanning speed benchmark
+ *
+ * Simulates the dirty bitmaps of a 64 GiB guest with 4 KiB pages and
+ * measures how fast the dirty pages are found (as migration does with
+ * find_next_bit) and how fast a sparse client bitmap is synced into the
+ * migration bitmap (as cpu_physical_memory_sync_dirty_bitmap does), for
+ * every scanning routine the host supports.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bitops.h"
+#include "qemu/bitmap.h"
+#include "qemu/atomic.h"
+
+#define GUEST_RAM       (64 * GiB)
+#define GUEST_PAGES     (GUEST_RAM / (4 * KiB))
+
+static void fill_bitmap(unsigned long *map, unsigned long one_in)
+{
+    unsigned long page;
+
+    bitmap_zero(map, GUEST_PAGES);
+    if (!one_in) {
+        return;
+    }
+    for (page = g_test_rand_int_range(0, one_in); page < GUEST_PAGES;
+         page += g_test_rand_int_range(1, 2 * one_in)) {
+        set_bit(page, map);
+    }
+}
+
+static unsigned long scan_bitmap(const unsigned long *map)
+{
+    unsigned long page, dirty = 0;
+
+    for (page = find_next_bit(map, GUEST_PAGES, 0); page < GUEST_PAGES;
+         page = find_next_bit(map, GUEST_PAGES, page + 1)) {
+        dirty++;
+    }
+    return dirty;
+}
+
+static unsigned long sync_bitmap(unsigned long *src, unsigned long *dest)
+{
+    unsigned long nwords = BITS_TO_LONGS(GUEST_PAGES);
+    unsigned long i, num_dirty = 0;
+
+    for (i = find_next_nonzero_word(src, nwords, 0); i < nwords;
+         i = find_next_nonzero_word(src, nwords, i + 1)) {
+        unsigned long bits = atomic_xchg(&src[i], 0);
+        unsigned long new_dirty = ~dest[i] & bits;
+
+        dest[i] |= bits;
+        num_dirty += ctpopl(new_dirty);
+    }
+    return num_dirty;
+}
+
+static void report(const char *what, unsigned long one_in, int variant,
+                   unsigned long iterations, double secs)
+{
+    g_print("%s, 1 dirty page in %lu, variant %d: %lu passes over 64 GiB "
+            "in %.2f secs: %.2f GiB/sec\n", what, one_in, variant,
+            iterations, secs, iterations * 64.0 / secs);
+}
+
+static void test_scan_speed(unsigned long *map, unsigned long one_in,
+                            int variant)
+{
+    unsigned long expected = bitmap_count_one(map, GUEST_PAGES);
+    unsigned long iterations = 0;
+
+    g_test_timer_start();
+    do {
+        g_assert_cmpint(scan_bitmap(map), ==, expected);
+        iterations++;
+    } while (g_test_timer_elapsed() < 1.0);
+    report("scan", one_in, variant, iterations, g_test_timer_last());
+}
+
+static void test_sync_speed(unsigned long *map, unsigned long one_in,
+                            int variant)
+{
+    unsigned long *src = bitmap_new(GUEST_PAGES);
+    unsigned long *dest = bitmap_new(GUEST_PAGES);
+    unsigned long expected = bitmap_count_one(map, GUEST_PAGES);
+    unsigned long iterations = 0;
+    int64_t elapsed = 0, start;
+
+    do {
+        /* Only the sync itself is timed, not setting up the bitmaps */
+        bitmap_copy(src, map, GUEST_PAGES);
+        bitmap_zero(dest, GUEST_PAGES);
+        start = g_get_monotonic_time();
+        g_assert_cmpint(sync_bitmap(src, dest), ==, expected);
+        elapsed += g_get_monotonic_time() - start;
+        iterations++;
+    } while (elapsed < G_USEC_PER_SEC);
+    report("sync", one_in, variant, iterations,
+           (double)elapsed / G_USEC_PER_SEC);
+
+    g_free(src);
+    g_free(dest);
+}
+
+static void test_bitmap_speed(void)
+{
+    static const unsigned long ratios[] = { 0, 1 << 20, 1 << 12, 1 << 6, 1 };
+    unsigned long *maps[ARRAY_SIZE(ratios)];
+    int i, variant = 0;
+
+    for (i = 0; i < ARRAY_SIZE(ratios); i++) {
+        maps[i] = bitmap_new(GUEST_PAGES);
+        fill_bitmap(maps[i], ratios[i]);
+    }
+
+    /* Variant 0 is the best routine for the host, the last one is C */
+    do {
+        for (i = 0; i < ARRAY_SIZE(ratios); i++) {
+            test_scan_speed(maps[i], ratios[i], variant);
+            test_sync_speed(maps[i], ratios[i], variant);
+        }
+        variant++;
+    } while (test_bitmap_scan_next_accel());
+
+    for (i = 0; i < ARRAY_SIZE(ratios); i++) {
+        g_free(maps[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bitmap/speed", test_bitmap_speed);
+
+    return g_test_run();
+}
@@ -118,3 +118,44 @@ int qrtas_ibm_write_pci_config(QTestState *qts, QGuestAllocator *alloc,
 
     return 0;
 }
+
+int qrtas_ibm_set_tce_bypass(QTestState *qts, QGuestAllocator *alloc,
+                             uint32_t unit, bool enable)
+{
+    int res;
+    uint32_t args[2], ret[1];
+
+    args[0] = unit;
+    args[1] = enable;
+    res = qrtas_call(qts, alloc, "ibm,set-tce-bypass", 2, args, 1, ret);
+    if (res != 0) {
+        return -1;
+    }
+
+    if (ret[0] != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int qrtas_ibm_set_xive(QTestState *qts, QGuestAllocator *alloc,
+                       uint32_t irq, uint32_t server, uint32_t priority)
+{
+    int res;
+    uint32_t args[3], ret[1];
+
+    args[0] = irq;
+    args[1] = server;
+    args[2] = priority;
+    res = qrtas_call(qts, alloc, "ibm,set-xive", 3, args, 1, ret);
+    if (res != 0) {
+        return -1;
+    }
+
+    if (ret[0] != 0) {
+        return -1;
+    }
+
+    return 0;
+}
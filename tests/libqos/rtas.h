@@ -14,4 +14,8 @@ uint32_t qrtas_ibm_read_pci_config(QTestState *qts, QGuestAllocator *alloc,
 int qrtas_ibm_write_pci_config(QTestState *qts, QGuestAllocator *alloc,
                                uint64_t buid, uint32_t addr, uint32_t size,
                                uint32_t val);
+int qrtas_ibm_set_tce_bypass(QTestState *qts, QGuestAllocator *alloc,
+                             uint32_t unit, bool enable);
+int qrtas_ibm_set_xive(QTestState *qts, QGuestAllocator *alloc,
+                       uint32_t irq, uint32_t server, uint32_t priority);
 #endif /* LIBQOS_RTAS_H */
@@ -0,0 +1,317 @@
+/*
+ * libqos driver for virtio 1.0 PCI devices with a packed ring
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/virtio-packed.h"
+#include "qemu/bswap.h"
+#include "hw/pci/pci_regs.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ring.h"
+#include "standard-headers/linux/virtio_pci.h"
+
+#define PACKED_DESC_SIZE 16
+
+static void qvirtio_packed_set_status(QVirtioPackedDevice *d, uint8_t status)
+{
+    qpci_io_writeb(d->pdev, d->bar, d->common + VIRTIO_PCI_COMMON_STATUS,
+                   status);
+}
+
+static uint8_t qvirtio_packed_get_status(QVirtioPackedDevice *d)
+{
+    return qpci_io_readb(d->pdev, d->bar,
+                         d->common + VIRTIO_PCI_COMMON_STATUS);
+}
+
+static void qvirtio_packed_find_caps(QVirtioPackedDevice *d)
+{
+    uint8_t addr = qpci_config_readb(d->pdev, PCI_CAPABILITY_LIST);
+    bool found_common = false, found_notify = false, found_device = false;
+    int bar = -1;
+
+    for (; addr; addr = qpci_config_readb(d->pdev, addr + PCI_CAP_LIST_NEXT)) {
+        uint8_t type;
+        uint32_t offset;
+
+        if (qpci_config_readb(d->pdev, addr) != PCI_CAP_ID_VNDR) {
+            continue;
+        }
+        type = qpci_config_readb(d->pdev, addr + VIRTIO_PCI_CAP_CFG_TYPE);
+        offset = qpci_config_readl(d->pdev, addr + VIRTIO_PCI_CAP_OFFSET);
+
+        switch (type) {
+        case VIRTIO_PCI_CAP_COMMON_CFG:
+            d->common = offset;
+            found_common = true;
+            break;
+        case VIRTIO_PCI_CAP_NOTIFY_CFG:
+            /* Skip the port I/O notification capability */
+            d->notify_mult = qpci_config_readl(d->pdev, addr +
+                offsetof(struct virtio_pci_notify_cap, notify_off_multiplier));
+            if (!d->notify_mult) {
+                continue;
+            }
+            d->notify = offset;
+            found_notify = true;
+            break;
+        case VIRTIO_PCI_CAP_DEVICE_CFG:
+            d->device = offset;
+            found_device = true;
+            break;
+        default:
+            continue;
+        }
+
+        /* All of them live in the same memory BAR */
+        if (bar == -1) {
+            bar = qpci_config_readb(d->pdev, addr + VIRTIO_PCI_CAP_BAR);
+        }
+        g_assert_cmpint(qpci_config_readb(d->pdev, addr + VIRTIO_PCI_CAP_BAR),
+                        ==, bar);
+    }
+
+    g_assert(found_common && found_notify && found_device);
+    d->bar = qpci_iomap(d->pdev, bar, NULL);
+}
+
+/**
+ * qvirtio_packed_device_init:
+ * @features: Device specific feature bits the driver accepts
+ *
+ * Resets the device at @devfn and negotiates VIRTIO_F_VERSION_1 and
+ * VIRTIO_F_RING_PACKED, plus the bits of @features the device offers.
+ * The queues must be set up before calling qvirtio_packed_set_driver_ok().
+ */
+QVirtioPackedDevice *qvirtio_packed_device_init(QPCIBus *bus, int devfn,
+                                                uint64_t features)
+{
+    QVirtioPackedDevice *d = g_new0(QVirtioPackedDevice, 1);
+    uint64_t host_features;
+
+    d->pdev = qpci_device_find(bus, devfn);
+    g_assert(d->pdev != NULL);
+    qpci_device_enable(d->pdev);
+    qvirtio_packed_find_caps(d);
+
+    qvirtio_packed_set_status(d, 0);
+    g_assert_cmphex(qvirtio_packed_get_status(d), ==, 0);
+    qvirtio_packed_set_status(d, VIRTIO_CONFIG_S_ACKNOWLEDGE);
+    qvirtio_packed_set_status(d, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+                                 VIRTIO_CONFIG_S_DRIVER);
+
+    qpci_io_writel(d->pdev, d->bar, d->common + VIRTIO_PCI_COMMON_DFSELECT, 0);
+    host_features = qpci_io_readl(d->pdev, d->bar,
+                                  d->common + VIRTIO_PCI_COMMON_DF);
+    qpci_io_writel(d->pdev, d->bar, d->common + VIRTIO_PCI_COMMON_DFSELECT, 1);
+    host_features |= (uint64_t)qpci_io_readl(d->pdev, d->bar,
+                                    d->common + VIRTIO_PCI_COMMON_DF) << 32;
+
+    g_assert(host_features & (1ull << VIRTIO_F_VERSION_1));
+    g_assert(host_features & (1ull << VIRTIO_F_RING_PACKED));
+    features = (features & host_features) | (1ull << VIRTIO_F_VERSION_1) |
+               (1ull << VIRTIO_F_RING_PACKED);
+
+    qpci_io_writel(d->pdev, d->bar, d->common + VIRTIO_PCI_COMMON_GFSELECT, 0);
+    qpci_io_writel(d->pdev, d->bar, d->common + VIRTIO_PCI_COMMON_GF,
+                   features);
+    qpci_io_writel(d->pdev, d->bar, d->common + VIRTIO_PCI_COMMON_GFSELECT, 1);
+    qpci_io_writel(d->pdev, d->bar, d->common + VIRTIO_PCI_COMMON_GF,
+                   features >> 32);
+
+    qvirtio_packed_set_status(d, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+                                 VIRTIO_CONFIG_S_DRIVER |
+                                 VIRTIO_CONFIG_S_FEATURES_OK);
+    g_assert(qvirtio_packed_get_status(d) & VIRTIO_CONFIG_S_FEATURES_OK);
+
+    return d;
+}
+
+void qvirtio_packed_device_free(QVirtioPackedDevice *d)
+{
+    qvirtio_packed_set_status(d, 0);
+    qpci_iounmap(d->pdev, d->bar);
+    g_free(d->pdev);
+    g_free(d);
+}
+
+void qvirtio_packed_set_driver_ok(QVirtioPackedDevice *d)
+{
+    qvirtio_packed_set_status(d, qvirtio_packed_get_status(d) |
+                                 VIRTIO_CONFIG_S_DRIVER_OK);
+    g_assert(!(qvirtio_packed_get_status(d) & VIRTIO_CONFIG_S_NEEDS_RESET));
+}
+
+QVirtQueuePacked *qvirtqueue_packed_setup(QVirtioPackedDevice *d,
+                                          QGuestAllocator *alloc,
+                                          uint16_t index, uint16_t size)
+{
+    QVirtQueuePacked *vq = g_new0(QVirtQueuePacked, 1);
+    uint64_t common = d->common;
+    uint16_t noff;
+    void *zero;
+
+    qpci_io_writew(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_SELECT, index);
+    g_assert_cmpint(qpci_io_readw(d->pdev, d->bar,
+                                  common + VIRTIO_PCI_COMMON_Q_SIZE), >=, size);
+    qpci_io_writew(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_SIZE, size);
+
+    vq->index = index;
+    vq->size = size;
+    vq->avail_wrap = true;
+    vq->used_wrap = true;
+
+    /* Both event suppression areas start out zero: notifications enabled */
+    vq->desc = guest_alloc(alloc, size * PACKED_DESC_SIZE);
+    vq->driver = guest_alloc(alloc, 4);
+    vq->device = guest_alloc(alloc, 4);
+    zero = g_malloc0(size * PACKED_DESC_SIZE);
+    memwrite(vq->desc, zero, size * PACKED_DESC_SIZE);
+    memwrite(vq->driver, zero, 4);
+    memwrite(vq->device, zero, 4);
+    g_free(zero);
+
+    qpci_io_writel(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_DESCLO,
+                   vq->desc);
+    qpci_io_writel(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_DESCHI,
+                   vq->desc >> 32);
+    qpci_io_writel(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_AVAILLO,
+                   vq->driver);
+    qpci_io_writel(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_AVAILHI,
+                   vq->driver >> 32);
+    qpci_io_writel(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_USEDLO,
+                   vq->device);
+    qpci_io_writel(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_USEDHI,
+                   vq->device >> 32);
+
+    noff = qpci_io_readw(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_NOFF);
+    vq->notify = d->notify + noff * d->notify_mult;
+
+    qpci_io_writew(d->pdev, d->bar, common + VIRTIO_PCI_COMMON_Q_ENABLE, 1);
+
+    return vq;
+}
+
+void qvirtqueue_packed_cleanup(QVirtQueuePacked *vq, QGuestAllocator *alloc)
+{
+    guest_free(alloc, vq->desc);
+    guest_free(alloc, vq->driver);
+    guest_free(alloc, vq->device);
+    g_free(vq);
+}
+
+static uint16_t qvirtqueue_packed_avail_flags(QVirtQueuePacked *vq)
+{
+    return vq->avail_wrap ? 1 << VRING_PACKED_DESC_F_AVAIL
+                          : 1 << VRING_PACKED_DESC_F_USED;
+}
+
+/**
+ * qvirtqueue_packed_add:
+ * @bufs: The buffers of the chain, in order
+ * @n: Number of buffers, at most the ring size
+ *
+ * Makes a descriptor chain available to the device.  The flags of the head
+ * descriptor are written last, so that the device never sees a partial
+ * chain.  Returns the buffer id of the chain.
+ */
+uint16_t qvirtqueue_packed_add(QVirtQueuePacked *vq,
+                               const QVirtioPackedBuf *bufs, int n)
+{
+    uint16_t id = vq->next_avail;
+    uint16_t head_flags = 0;
+    int i;
+
+    g_assert_cmpint(n, >, 0);
+    g_assert_cmpint(n, <=, vq->size);
+
+    for (i = 0; i < n; i++) {
+        uint8_t desc[PACKED_DESC_SIZE];
+        uint16_t flags = qvirtqueue_packed_avail_flags(vq);
+
+        if (bufs[i].write) {
+            flags |= VRING_DESC_F_WRITE;
+        }
+        if (i < n - 1) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+
+        stq_le_p(desc, bufs[i].addr);
+        stl_le_p(desc + 8, bufs[i].len);
+        stw_le_p(desc + 12, id);
+        if (i == 0) {
+            head_flags = flags;
+            memwrite(vq->desc + vq->next_avail * PACKED_DESC_SIZE, desc, 14);
+        } else {
+            stw_le_p(desc + 14, flags);
+            memwrite(vq->desc + vq->next_avail * PACKED_DESC_SIZE, desc,
+                     PACKED_DESC_SIZE);
+        }
+
+        if (++vq->next_avail == vq->size) {
+            vq->next_avail = 0;
+            vq->avail_wrap = !vq->avail_wrap;
+        }
+    }
+
+    stw_le_p(&head_flags, head_flags);
+    memwrite(vq->desc + id * PACKED_DESC_SIZE + 14, &head_flags, 2);
+
+    return id;
+}
+
+void qvirtqueue_packed_kick(QVirtioPackedDevice *d, QVirtQueuePacked *vq)
+{
+    qpci_io_writew(d->pdev, d->bar, vq->notify, vq->index);
+}
+
+/**
+ * qvirtqueue_packed_wait:
+ * @id: The buffer id of the expected chain
+ * @ndescs: Number of descriptors in that chain
+ * @len: A pointer that is filled with the length written into the buffer, may
+ *       be NULL
+ * @timeout_us: How many microseconds to wait before failing
+ *
+ * Waits for the device to mark the next chain used, and checks that it is
+ * the chain @id.
+ */
+void qvirtqueue_packed_wait(QVirtQueuePacked *vq, uint16_t id, int ndescs,
+                            uint32_t *len, gint64 timeout_us)
+{
+    gint64 start_time = g_get_monotonic_time();
+    uint64_t addr = vq->desc + vq->next_used * PACKED_DESC_SIZE;
+    uint8_t desc[PACKED_DESC_SIZE];
+
+    for (;;) {
+        uint16_t flags;
+        bool avail, used;
+
+        clock_step(100);
+
+        memread(addr, desc, PACKED_DESC_SIZE);
+        flags = lduw_le_p(desc + 14);
+        avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+        used = flags & (1 << VRING_PACKED_DESC_F_USED);
+        if (avail == used && used == vq->used_wrap) {
+            break;
+        }
+
+        g_assert(g_get_monotonic_time() - start_time <= timeout_us);
+    }
+
+    g_assert_cmpint(lduw_le_p(desc + 12), ==, id);
+    if (len) {
+        *len = ldl_le_p(desc + 8);
+    }
+
+    vq->next_used += ndescs;
+    if (vq->next_used >= vq->size) {
+        vq->next_used -= vq->size;
+        vq->used_wrap = !vq->used_wrap;
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * libqos driver for virtio 1.0 PCI devices with a packed ring
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef LIBQOS_VIRTIO_PACKED_H
+#define LIBQOS_VIRTIO_PACKED_H
+
+#include "libqos/malloc.h"
+#include "libqos/pci.h"
+
+/*
+ * The rest of libqos only drives legacy virtio-pci, whose 32-bit feature
+ * word cannot negotiate VIRTIO_F_RING_PACKED.  This driver goes through
+ * the modern capabilities instead.
+ */
+typedef struct QVirtioPackedDevice {
+    QPCIDevice *pdev;
+    QPCIBar bar;
+    /* Offsets of the configuration structures in the modern BAR */
+    uint64_t common;
+    uint64_t notify;
+    uint64_t device;
+    uint32_t notify_mult;
+} QVirtioPackedDevice;
+
+typedef struct QVirtQueuePacked {
+    uint64_t desc; /* This points to an array of struct vring_packed_desc */
+    uint64_t driver; /* Driver event suppression area */
+    uint64_t device; /* Device event suppression area */
+    uint64_t notify; /* Notification address in the modern BAR */
+    uint16_t index;
+    uint16_t size;
+    uint16_t next_avail;
+    uint16_t next_used;
+    bool avail_wrap;
+    bool used_wrap;
+} QVirtQueuePacked;
+
+typedef struct QVirtioPackedBuf {
+    uint64_t addr;
+    uint32_t len;
+    bool write;
+} QVirtioPackedBuf;
+
+QVirtioPackedDevice *qvirtio_packed_device_init(QPCIBus *bus, int devfn,
+                                                uint64_t features);
+void qvirtio_packed_device_free(QVirtioPackedDevice *d);
+void qvirtio_packed_set_driver_ok(QVirtioPackedDevice *d);
+
+QVirtQueuePacked *qvirtqueue_packed_setup(QVirtioPackedDevice *d,
+                                          QGuestAllocator *alloc,
+                                          uint16_t index, uint16_t size);
+void qvirtqueue_packed_cleanup(QVirtQueuePacked *vq, QGuestAllocator *alloc);
+
+uint16_t qvirtqueue_packed_add(QVirtQueuePacked *vq,
+                               const QVirtioPackedBuf *bufs, int n);
+void qvirtqueue_packed_kick(QVirtioPackedDevice *d, QVirtQueuePacked *vq);
+void qvirtqueue_packed_wait(QVirtQueuePacked *vq, uint16_t id, int ndescs,
+                            uint32_t *len, gint64 timeout_us);
+
+#endif
@@ -920,6 +920,34 @@ uint64_t qtest_rtas_call(QTestState *s, const char *name,
     return 0;
 }
 
+uint64_t qtest_hcall(QTestState *s, uint64_t opcode,
+                     uint32_t nargs, uint64_t *args)
+{
+    GString *cmd = g_string_new(NULL);
+    gchar **rsp;
+    uint64_t res;
+    uint32_t i;
+    int ret;
+
+    g_string_printf(cmd, "hcall 0x%"PRIx64, opcode);
+    for (i = 0; i < nargs; i++) {
+        g_string_append_printf(cmd, " 0x%"PRIx64, args[i]);
+    }
+    qtest_sendf(s, "%s\n", cmd->str);
+    g_string_free(cmd, true);
+
+    rsp = qtest_rsp(s, nargs + 2);
+    ret = qemu_strtou64(rsp[1], NULL, 0, &res);
+    g_assert(!ret);
+    for (i = 0; i < nargs; i++) {
+        ret = qemu_strtou64(rsp[i + 2], NULL, 0, &args[i]);
+        g_assert(!ret);
+    }
+    g_strfreev(rsp);
+
+    return res;
+}
+
 void qtest_add_func(const char *str, void (*fn)(void))
 {
     gchar *path = g_strdup_printf("/%s/%s", qtest_get_arch(), str);
@@ -410,6 +410,19 @@ uint64_t qtest_rtas_call(QTestState *s, const char *name,
                          uint32_t nargs, uint64_t args,
                          uint32_t nret, uint64_t ret);
 
+/**
+ * qtest_hcall:
+ * @s: #QTestState instance to operate on.
+ * @opcode: PAPR hypercall number.
+ * @nargs: Number of args (at most 9).
+ * @args: Hypercall arguments, as passed in r4 and up. They are updated
+ * with the values returned in the same registers.
+ *
+ * Call a sPAPR hypercall on the first vCPU and return its result.
+ */
+uint64_t qtest_hcall(QTestState *s, uint64_t opcode,
+                     uint32_t nargs, uint64_t *args);
+
 /**
  * qtest_bufread:
  * @s: #QTestState instance to operate on.
@@ -0,0 +1,121 @@
+/*
+ * QTest testcase for mapped snapshots (savevm-mapped / loadvm-mapped)
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+#define PATTERN_ADDR    0x100000
+#define PATTERN_SIZE    0x3000
+#define HIGH_ADDR       0x3000000
+
+static void fill(QTestState *qts, uint64_t addr, uint8_t seed)
+{
+    uint8_t buf[PATTERN_SIZE];
+    int i;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = seed + i * 7;
+    }
+    qtest_memwrite(qts, addr, buf, sizeof(buf));
+}
+
+static void check(QTestState *qts, uint64_t addr, uint8_t seed)
+{
+    uint8_t buf[PATTERN_SIZE];
+    int i;
+
+    qtest_memread(qts, addr, buf, sizeof(buf));
+    for (i = 0; i < sizeof(buf); i++) {
+        g_assert_cmphex(buf[i], ==, (uint8_t)(seed + i * 7));
+    }
+}
+
+static bool snapshot_cmd(QTestState *qts, const char *cmd,
+                         const char *filename)
+{
+    QDict *rsp;
+    bool ok;
+
+    rsp = qtest_qmp(qts, "{ 'execute': %s, 'arguments': { 'filename': %s } }",
+                    cmd, filename);
+    ok = qdict_haskey(rsp, "return");
+    g_assert(ok || qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+    return ok;
+}
+
+static void test_round_trip(void)
+{
+    char snapshot[] = "/tmp/qtest-mapped-snapshot-XXXXXX";
+    QTestState *qts;
+    int fd;
+
+    fd = mkstemp(snapshot);
+    g_assert(fd != -1);
+    close(fd);
+
+    qts = qtest_init("-m 64");
+
+    fill(qts, PATTERN_ADDR, 1);
+    fill(qts, HIGH_ADDR, 2);
+    g_assert(snapshot_cmd(qts, "savevm-mapped", snapshot));
+
+    /* Both pages written after the save and pages that were zero */
+    fill(qts, PATTERN_ADDR, 3);
+    fill(qts, HIGH_ADDR + PATTERN_SIZE, 4);
+    g_assert(snapshot_cmd(qts, "loadvm-mapped", snapshot));
+
+    check(qts, PATTERN_ADDR, 1);
+    check(qts, HIGH_ADDR, 2);
+    g_assert_cmphex(qtest_readq(qts, HIGH_ADDR + PATTERN_SIZE), ==, 0);
+
+    /* Loading again gives the same state, writes stay private */
+    fill(qts, HIGH_ADDR, 5);
+    g_assert(snapshot_cmd(qts, "loadvm-mapped", snapshot));
+    check(qts, HIGH_ADDR, 2);
+
+    qtest_quit(qts);
+    unlink(snapshot);
+}
+
+static void test_truncated(void)
+{
+    char snapshot[] = "/tmp/qtest-mapped-snapshot-XXXXXX";
+    QTestState *qts;
+    int fd;
+
+    fd = mkstemp(snapshot);
+    g_assert(fd != -1);
+
+    qts = qtest_init("-m 64");
+
+    fill(qts, HIGH_ADDR, 1);
+    g_assert(snapshot_cmd(qts, "savevm-mapped", snapshot));
+
+    /* Cut the file in the middle of guest RAM */
+    g_assert(ftruncate(fd, HIGH_ADDR / 2) == 0);
+    close(fd);
+
+    /* The load is refused before anything is mapped or reset */
+    fill(qts, HIGH_ADDR, 2);
+    g_assert(!snapshot_cmd(qts, "loadvm-mapped", snapshot));
+    check(qts, HIGH_ADDR, 2);
+
+    qtest_quit(qts);
+    unlink(snapshot);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("mapped-snapshot/round-trip", test_round_trip);
+    qtest_add_func("mapped-snapshot/truncated", test_truncated);
+
+    return g_test_run();
+}
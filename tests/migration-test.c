@@ -357,6 +357,48 @@ static void migrate_set_parameter(QTestState *who, const char *parameter,
     migrate_check_parameter(who, parameter, value);
 }
 
+static void migrate_set_parameter_str(QTestState *who, const char *parameter,
+                                      const char *value)
+{
+    QDict *rsp;
+
+    rsp = qtest_qmp(who,
+                    "{ 'execute': 'migrate-set-parameters',"
+                    "'arguments': { %s: %s } }",
+                    parameter, value);
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+
+    rsp = wait_command(who, "{ 'execute': 'query-migrate-parameters' }");
+    g_assert_cmpstr(qdict_get_str(rsp, parameter), ==, value);
+    qobject_unref(rsp);
+}
+
+static void migrate_set_parameter_invalid(QTestState *who,
+                                          const char *parameter,
+                                          long long value)
+{
+    QDict *rsp;
+
+    rsp = qtest_qmp(who,
+                    "{ 'execute': 'migrate-set-parameters',"
+                    "'arguments': { %s: %lld } }",
+                    parameter, value);
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+}
+
+static void migrate_incoming(QTestState *who, const char *uri)
+{
+    QDict *rsp;
+
+    rsp = wait_command(who,
+                       "{ 'execute': 'migrate-incoming',"
+                       "  'arguments': { 'uri': %s } }",
+                       uri);
+    qobject_unref(rsp);
+}
+
 static void migrate_pause(QTestState *who)
 {
     QDict *rsp;
@@ -781,6 +823,73 @@ static void test_precopy_unix(void)
     g_free(uri);
 }
 
+static void test_multifd_params(void)
+{
+    QTestState *from;
+
+    from = qtest_start("-machine none");
+
+    /* Out of range levels, negative ones included, leave the default */
+    migrate_set_parameter_invalid(from, "x-multifd-zlib-level", -1);
+    migrate_set_parameter_invalid(from, "x-multifd-zlib-level", 10);
+    migrate_check_parameter(from, "x-multifd-zlib-level", 1);
+    migrate_set_parameter_invalid(from, "x-multifd-zstd-level", -1);
+    migrate_set_parameter_invalid(from, "x-multifd-zstd-level", 21);
+    migrate_check_parameter(from, "x-multifd-zstd-level", 1);
+
+    migrate_set_parameter(from, "x-multifd-zlib-level", 9);
+    migrate_set_parameter(from, "x-multifd-zstd-level", 20);
+
+    qtest_quit(from);
+}
+
+static void test_multifd_unix(const void *data)
+{
+    const char *compression = data;
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, "defer", false)) {
+        return;
+    }
+
+    /* 1 ms should make it not converge */
+    migrate_set_parameter(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter(from, "max-bandwidth", 1000000000);
+
+    migrate_set_capability(from, "x-multifd", true);
+    migrate_set_capability(to, "x-multifd", true);
+    migrate_set_parameter(from, "x-multifd-channels", 4);
+    migrate_set_parameter(to, "x-multifd-channels", 4);
+    migrate_set_parameter_str(from, "x-multifd-compression", compression);
+    migrate_set_parameter_str(to, "x-multifd-compression", compression);
+
+    migrate_incoming(to, uri);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    /* 300 ms should converge */
+    migrate_set_parameter(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
 int main(int argc, char **argv)
 {
     char template[] = "/tmp/migration-test-XXXXXX";
@@ -832,6 +941,13 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/deprecated", test_deprecated);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
+    qtest_add_func("/migration/multifd/params", test_multifd_params);
+    qtest_add_data_func("/migration/multifd/unix/zlib", "zlib",
+                        test_multifd_unix);
+#ifdef CONFIG_ZSTD
+    qtest_add_data_func("/migration/multifd/unix/zstd", "zstd",
+                        test_multifd_unix);
+#endif
 
     ret = g_test_run();
 
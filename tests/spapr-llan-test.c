@@ -0,0 +1,276 @@
+/*
+ * QTest testcase for the sPAPR virtual LAN (spapr-vlan) device
+ *
+ * Two spapr-vlan devices are connected through a hub, frames are sent from
+ * one of them with H_SEND_LOGICAL_LAN and checked in the receive queue of
+ * the other one. Interrupt coalescing in batch mode is checked by polling
+ * the interrupt presentation controller. With "-m perf", the frame rate with
+ * and without batch mode, and with and without pinned receive DMA, is
+ * measured as well.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/libqos-spapr.h"
+#include "libqos/rtas.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/timer.h"
+
+#define H_SUCCESS                   0
+#define H_CPPR                      0x68
+#define H_IPOLL                     0x70
+#define H_VIO_SIGNAL                0x104
+#define H_REGISTER_LOGICAL_LAN      0x114
+#define H_ADD_LOGICAL_LAN_BUFFER    0x11C
+#define H_SEND_LOGICAL_LAN          0x120
+
+#define VLAN_BD_VALID               0x8000000000000000ULL
+#define VLAN_BD(addr, len)          (VLAN_BD_VALID | ((uint64_t)(len) << 32) | \
+                                     (addr))
+#define VLAN_RXQC_VALID             0x40
+
+#define TX_REG                      0x71000100
+#define RX_REG                      0x71000200
+
+#define XISR_MASK                   0x00ffffff
+#define RX_IRQ_PRIORITY             5
+
+#define PAGE_SIZE                   4096
+#define FRAME_LEN                   64
+#define RX_BUF_LEN                  128
+
+typedef struct {
+    QOSState *qs;
+    uint64_t rxq;
+    uint64_t rx_buf;
+    uint64_t tx_buf;
+} TestLlan;
+
+static uint64_t llan_hcall(TestLlan *t, uint64_t opcode, uint32_t nargs,
+                           uint64_t *args)
+{
+    return qtest_hcall(t->qs->qts, opcode, nargs, args);
+}
+
+static void llan_open(TestLlan *t, uint32_t reg, uint64_t rxq)
+{
+    QGuestAllocator *alloc = t->qs->alloc;
+    uint64_t args[4];
+
+    g_assert_cmpint(qrtas_ibm_set_tce_bypass(t->qs->qts, alloc, reg, true),
+                    ==, 0);
+
+    args[0] = reg;
+    args[1] = guest_alloc(alloc, PAGE_SIZE);
+    args[2] = VLAN_BD(rxq, PAGE_SIZE);
+    args[3] = guest_alloc(alloc, PAGE_SIZE);
+    g_assert_cmpint(llan_hcall(t, H_REGISTER_LOGICAL_LAN, 4, args), ==,
+                    H_SUCCESS);
+}
+
+static void llan_setup(TestLlan *t, const char *opts)
+{
+    uint8_t frame[FRAME_LEN];
+    int i;
+
+    t->qs = qtest_spapr_boot("-machine pseries "
+                             "-netdev hubport,id=tx,hubid=0 "
+                             "-device spapr-vlan,id=vlan-tx,netdev=tx,"
+                             "reg=0x%x,%s "
+                             "-netdev hubport,id=rx,hubid=0 "
+                             "-device spapr-vlan,id=vlan-rx,netdev=rx,"
+                             "reg=0x%x,%s",
+                             TX_REG, opts, RX_REG, opts);
+
+    t->rxq = guest_alloc(t->qs->alloc, PAGE_SIZE);
+    t->rx_buf = guest_alloc(t->qs->alloc, PAGE_SIZE);
+    t->tx_buf = guest_alloc(t->qs->alloc, PAGE_SIZE);
+
+    llan_open(t, TX_REG, guest_alloc(t->qs->alloc, PAGE_SIZE));
+    llan_open(t, RX_REG, t->rxq);
+
+    /* Broadcast frame with a recognizable payload */
+    memset(frame, 0xff, 12);
+    for (i = 12; i < FRAME_LEN; i++) {
+        frame[i] = i;
+    }
+    qtest_memwrite(t->qs->qts, t->tx_buf, frame, sizeof(frame));
+    qtest_writeq(t->qs->qts, t->rx_buf, 0x1234abcd);
+}
+
+static void llan_teardown(TestLlan *t)
+{
+    qtest_shutdown(t->qs);
+}
+
+static void llan_add_buffer(TestLlan *t, uint64_t buf)
+{
+    uint64_t args[2];
+
+    args[0] = RX_REG;
+    args[1] = VLAN_BD(buf, RX_BUF_LEN);
+    g_assert_cmpint(llan_hcall(t, H_ADD_LOGICAL_LAN_BUFFER, 2, args), ==,
+                    H_SUCCESS);
+}
+
+static void llan_send(TestLlan *t)
+{
+    uint64_t args[8] = { 0 };
+
+    args[0] = TX_REG;
+    args[1] = VLAN_BD(t->tx_buf, FRAME_LEN);
+    g_assert_cmpint(llan_hcall(t, H_SEND_LOGICAL_LAN, 8, args), ==,
+                    H_SUCCESS);
+}
+
+static void llan_transfer(TestLlan *t)
+{
+    llan_add_buffer(t, t->rx_buf);
+    llan_send(t);
+}
+
+/*
+ * Route the interrupt of the receiving device to the first vCPU and
+ * enable it, and return its number.
+ */
+static uint32_t llan_enable_rx_irq(TestLlan *t)
+{
+    QDict *rsp;
+    uint64_t args[2];
+    uint32_t irq;
+
+    rsp = qtest_qmp(t->qs->qts, "{ 'execute': 'qom-get', 'arguments': "
+                    "{ 'path': '/machine/peripheral/vlan-rx', "
+                    "'property': 'irq' } }");
+    irq = qdict_get_int(rsp, "return");
+    qobject_unref(rsp);
+
+    g_assert_cmpint(qrtas_ibm_set_xive(t->qs->qts, t->qs->alloc, irq, 0,
+                                       RX_IRQ_PRIORITY), ==, 0);
+
+    args[0] = 0xff;
+    g_assert_cmpint(llan_hcall(t, H_CPPR, 1, args), ==, H_SUCCESS);
+
+    args[0] = RX_REG;
+    args[1] = 1;
+    g_assert_cmpint(llan_hcall(t, H_VIO_SIGNAL, 2, args), ==, H_SUCCESS);
+
+    return irq;
+}
+
+/* Return the source of the interrupt pending on the first vCPU, if any */
+static uint32_t llan_pending_irq(TestLlan *t)
+{
+    uint64_t args[2] = { 0 };
+
+    g_assert_cmpint(llan_hcall(t, H_IPOLL, 2, args), ==, H_SUCCESS);
+
+    return args[0] & XISR_MASK;
+}
+
+static void test_llan_send_receive(const void *data)
+{
+    TestLlan t;
+    uint8_t tx[FRAME_LEN], rx[FRAME_LEN];
+
+    llan_setup(&t, data);
+    llan_transfer(&t);
+
+    g_assert(qtest_readb(t.qs->qts, t.rxq) & VLAN_RXQC_VALID);
+    g_assert_cmpint(qtest_readl(t.qs->qts, t.rxq + 4), ==, FRAME_LEN);
+    g_assert_cmphex(qtest_readq(t.qs->qts, t.rxq + 8), ==, 0x1234abcd);
+
+    qtest_memread(t.qs->qts, t.tx_buf, tx, sizeof(tx));
+    qtest_memread(t.qs->qts, t.rx_buf + 8, rx, sizeof(rx));
+    g_assert(!memcmp(tx, rx, FRAME_LEN));
+
+    llan_teardown(&t);
+}
+
+#define COALESCE_FRAMES             4
+#define COALESCE_USECS              200
+
+static void test_llan_rx_coalesce(void)
+{
+    TestLlan t;
+    char *opts;
+    uint32_t irq;
+    int i;
+
+    opts = g_strdup_printf("batch=on,rx-coalesce-frames=%d,"
+                           "rx-coalesce-usecs=%d",
+                           COALESCE_FRAMES, COALESCE_USECS);
+    llan_setup(&t, opts);
+    g_free(opts);
+    irq = llan_enable_rx_irq(&t);
+
+    /* Post more buffers than frames, so that they do not run out */
+    for (i = 0; i < COALESCE_FRAMES; i++) {
+        llan_add_buffer(&t, t.rx_buf + i * RX_BUF_LEN);
+    }
+
+    /* Frames below the threshold are received, but not signalled yet */
+    for (i = 0; i < COALESCE_FRAMES - 2; i++) {
+        llan_send(&t);
+        g_assert(qtest_readb(t.qs->qts, t.rxq + i * 16) & VLAN_RXQC_VALID);
+    }
+    g_assert_cmpint(llan_pending_irq(&t), ==, 0);
+
+    qtest_clock_step(t.qs->qts, (COALESCE_USECS - 1) * SCALE_US);
+    g_assert_cmpint(llan_pending_irq(&t), ==, 0);
+
+    /* The timer delivers the interrupt once rx-coalesce-usecs have passed */
+    qtest_clock_step(t.qs->qts, SCALE_US);
+    g_assert_cmpint(llan_pending_irq(&t), ==, irq);
+
+    llan_teardown(&t);
+}
+
+static void test_llan_throughput(const void *data)
+{
+    TestLlan t;
+    uint64_t frames = 0;
+
+    llan_setup(&t, data);
+
+    g_test_timer_start();
+    do {
+        llan_transfer(&t);
+        frames++;
+    } while (g_test_timer_elapsed() < 1.0);
+
+    g_test_maximized_result(frames / g_test_timer_last(),
+                            "%s: %.0f frames/sec", (const char *)data,
+                            frames / g_test_timer_last());
+
+    llan_teardown(&t);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_data_func("spapr-llan/send-receive", "batch=off",
+                        test_llan_send_receive);
+    qtest_add_data_func("spapr-llan/send-receive-batch", "batch=on",
+                        test_llan_send_receive);
+    qtest_add_data_func("spapr-llan/send-receive-nopin",
+                        "batch=off,x-dma-pin=off", test_llan_send_receive);
+    qtest_add_func("spapr-llan/rx-coalesce", test_llan_rx_coalesce);
+
+    if (g_test_perf()) {
+        qtest_add_data_func("spapr-llan/throughput", "batch=off",
+                            test_llan_throughput);
+        qtest_add_data_func("spapr-llan/throughput-batch", "batch=on",
+                            test_llan_throughput);
+        qtest_add_data_func("spapr-llan/throughput-nopin",
+                            "batch=off,x-dma-pin=off", test_llan_throughput);
+        qtest_add_data_func("spapr-llan/throughput-batch-nopin",
+                            "batch=on,x-dma-pin=off", test_llan_throughput);
+    }
+
+    return g_test_run();
+}
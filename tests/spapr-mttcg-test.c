@@ -0,0 +1,208 @@
+/*
+ * QTest testcase for multi-threaded TCG on the pseries machine
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A small firmware starts the secondary vCPUs with RTAS start-cpu.  Every
+ * vCPU then repeatedly enters and removes an HPTE (H_REMOVE flushes the
+ * TLBs of all vCPUs with tlb_flush_all_cpus_synced) and invalidates an SLB
+ * entry with slbieg/slbsync, which queues the same synced flush from
+ * translated code.  Once all of them are done, vCPU 0 asks for the AFL
+ * fork server.  Without AFL attached it forks once and both processes
+ * restart every vCPU thread, run the loop again, print PASS and exit.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qemu/bswap.h"
+
+#define qmp_discard_response(qs, ...) qobject_unref(qtest_qmp(qs, __VA_ARGS__))
+
+/* Loaded at 0, execution starts at 0x100 */
+#define FW_ENTRY 0x100
+
+static const uint32_t fw_mttcg[] = {
+    /* _start: start vCPUs 1-3 (vcpu ids 8, 16, 24) at "secondary" */
+    0x3ba00001, /* li      r29,1 */
+    0x39201100, /* li      r9,0x1100        RTAS args */
+    0x39402006, /* li      r10,0x2006       RTAS_START_CPU */
+    0x91490000, /* stw     r10,0(r9) */
+    0x39400003, /* li      r10,3            nargs */
+    0x91490004, /* stw     r10,4(r9) */
+    0x39400001, /* li      r10,1            nret */
+    0x91490008, /* stw     r10,8(r9) */
+    0x7baa1f24, /* sldi    r10,r29,3        id */
+    0x9149000c, /* stw     r10,12(r9) */
+    0x39400154, /* li      r10,secondary    start */
+    0x91490010, /* stw     r10,16(r9) */
+    0x93a90014, /* stw     r29,20(r9)       r3 */
+    0x38600000, /* li      r3,0 */
+    0x6063f000, /* ori     r3,r3,0xf000     KVMPPC_H_RTAS */
+    0x7d244b78, /* mr      r4,r9 */
+    0x44000022, /* sc      1 */
+    0x3bbd0001, /* addi    r29,r29,1 */
+    0x2c3d0004, /* cmpdi   r29,4 */
+    0x4180ffb8, /* blt     _start+4 */
+    0x38600000, /* li      r3,0 */
+    /* secondary: r30 = vCPU number */
+    0x7c7e1b78, /* mr      r30,r3 */
+    0x3b401000, /* li      r26,0x1000       phase 1 counter */
+    0x48000091, /* bl      work */
+    0x2c3e0000, /* cmpdi   r30,0 */
+    0x40820034, /* bne     park */
+    0xe8a01000, /* 1: ld   r5,0x1000(0) */
+    0x2c250004, /* cmpdi   r5,4 */
+    0x4082fff8, /* bne     1b */
+    0x38600003, /* li      r3,3 */
+    0x04000000, /* afl                      start fork server */
+    0x38600006, /* 2: li   r3,6 */
+    0x04000000, /* afl                      r3 = afl_fork_child */
+    0x2c230000, /* cmpdi   r3,0 */
+    0x4182fff4, /* beq     2b */
+    0x38a00001, /* li      r5,1 */
+    0xf8a01010, /* std     r5,0x1010(0)     release the others */
+    0x48000010, /* b       phase2 */
+    /* park: */
+    0xe8a01010, /* ld      r5,0x1010(0) */
+    0x2c250000, /* cmpdi   r5,0 */
+    0x4182fff8, /* beq     park */
+    /* phase2: */
+    0x3b401008, /* li      r26,0x1008       phase 2 counter */
+    0x48000045, /* bl      work */
+    0x2c3e0000, /* cmpdi   r30,0 */
+    0x40820038, /* bne     idle */
+    0xe8a01008, /* 3: ld   r5,0x1008(0) */
+    0x2c250004, /* cmpdi   r5,4 */
+    0x4082fff8, /* bne     3b */
+    0x38600058, /* li      r3,0x58          H_PUT_TERM_CHAR */
+    0x38800000, /* li      r4,0 */
+    0x38a00005, /* li      r5,5 */
+    0x3cc05041, /* lis     r6,0x5041 */
+    0x60c65353, /* ori     r6,r6,0x5353 */
+    0x78c607c6, /* sldi    r6,r6,32 */
+    0x64c60a00, /* oris    r6,r6,0x0a00     "PASS\n" */
+    0x44000022, /* sc      1 */
+    0x38600005, /* li      r3,5 */
+    0x04000000, /* afl                      _exit(0) */
+    /* idle: */
+    0x48000000, /* b       idle */
+    /* work: */
+    0x3b800010, /* li      r28,16 */
+    0x38600008, /* 4: li   r3,0x08          H_ENTER */
+    0x38800000, /* li      r4,0 */
+    0x38be0001, /* addi    r5,r30,1 */
+    0x78a51f24, /* sldi    r5,r5,3          PTEG of this vCPU */
+    0x38de0001, /* addi    r6,r30,1 */
+    0x78c664e4, /* sldi    r6,r6,12 */
+    0x60c60001, /* ori     r6,r6,1          HPTE64_V_VALID */
+    0x3ce00001, /* lis     r7,1 */
+    0x60e70010, /* ori     r7,r7,0x10       WIMG = M */
+    0x44000022, /* sc      1 */
+    0x2c230000, /* cmpdi   r3,0 */
+    0x40820064, /* bne     fail */
+    0x7c852378, /* mr      r5,r4 */
+    0x38600004, /* li      r3,0x04          H_REMOVE */
+    0x38800000, /* li      r4,0 */
+    0x38c00000, /* li      r6,0 */
+    0x44000022, /* sc      1 */
+    0x2c230000, /* cmpdi   r3,0 */
+    0x40820048, /* bne     fail */
+    0x7c4004ac, /* ptesync */
+    0x3ca01000, /* lis     r5,0x1000 */
+    0x64a40800, /* oris    r4,r5,0x0800     ESID 1, valid, entry 0 */
+    0x3ca00000, /* lis     r5,0 */
+    0x60a51000, /* ori     r5,r5,0x1000     VSID 1 */
+    0x7ca02324, /* slbmte  r5,r4 */
+    0x3c801000, /* lis     r4,0x1000 */
+    0x7c0023a4, /* slbieg  r0,r4 */
+    0x7c0002a4, /* slbsync */
+    0x3b9cffff, /* addi    r28,r28,-1 */
+    0x2c3c0000, /* cmpdi   r28,0 */
+    0x4082ff88, /* bne     4b */
+    0x7ca0d0a8, /* 5: ldarx r5,0,r26 */
+    0x38a50001, /* addi    r5,r5,1 */
+    0x7ca0d1ad, /* stdcx.  r5,0,r26 */
+    0x4082fff4, /* bne     5b */
+    0x4e800020, /* blr */
+    /* fail: */
+    0x38600058, /* li      r3,0x58          H_PUT_TERM_CHAR */
+    0x38800000, /* li      r4,0 */
+    0x38a00005, /* li      r5,5 */
+    0x3cc04641, /* lis     r6,0x4641 */
+    0x60c6494c, /* ori     r6,r6,0x494c */
+    0x78c607c6, /* sldi    r6,r6,32 */
+    0x64c60a00, /* oris    r6,r6,0x0a00     "FAIL\n" */
+    0x44000022, /* sc      1 */
+    0x4bffff48, /* b       idle */
+};
+
+static int count_matches(const char *haystack, const char *needle)
+{
+    int n = 0;
+
+    while ((haystack = strstr(haystack, needle))) {
+        haystack += strlen(needle);
+        n++;
+    }
+    return n;
+}
+
+static void test_mttcg_fork(void)
+{
+    char serialtmp[] = "/tmp/qtest-spapr-mttcg-sXXXXXX";
+    char fwtmp[] = "/tmp/qtest-spapr-mttcg-fXXXXXX";
+    uint8_t fw[FW_ENTRY + sizeof(fw_mttcg)] = { 0 };
+    QTestState *qts;
+    gchar *out = NULL;
+    int passed = 0, i, fd;
+    time_t start;
+
+    for (i = 0; i < ARRAY_SIZE(fw_mttcg); i++) {
+        stl_be_p(fw + FW_ENTRY + i * 4, fw_mttcg[i]);
+    }
+
+    fd = mkstemp(fwtmp);
+    g_assert(fd != -1);
+    g_assert(write(fd, fw, sizeof(fw)) == sizeof(fw));
+    close(fd);
+
+    fd = mkstemp(serialtmp);
+    g_assert(fd != -1);
+    close(fd);
+
+    /* Stopped until the QMP handshake is done: the guest exits by itself */
+    qts = qtest_initf("-machine pseries -cpu POWER9 -smp 4 "
+                      "-accel tcg,thread=multi -bios %s -S "
+                      "-chardev file,id=serial0,path=%s "
+                      "-serial chardev:serial0", fwtmp, serialtmp);
+    qmp_discard_response(qts, "{ 'execute': 'cont' }");
+
+    /* Both the fork server parent and its child must finish */
+    start = time(NULL);
+    while (time(NULL) - start < 120) {
+        g_free(out);
+        g_assert(g_file_get_contents(serialtmp, &out, NULL, NULL));
+        g_assert(!strstr(out, "FAIL"));
+        passed = count_matches(out, "PASS");
+        if (passed == 2) {
+            break;
+        }
+        g_usleep(10000);
+    }
+    g_assert_cmpint(passed, ==, 2);
+    g_free(out);
+
+    qtest_quit(qts);
+    unlink(serialtmp);
+    unlink(fwtmp);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("spapr/mttcg/fork", test_mttcg_fork);
+
+    return g_test_run();
+}
@@ -0,0 +1,102 @@
+/*
+ * QTest testcase for recycling a full TCG code cache a few regions at a time
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define LOAD_ADDR       0x100000
+#define ENTRY_OFFSET    0x20
+#define SLOT_OFFSET     0x1000
+
+/*
+ * Multiboot header with the load addresses given explicitly (the "a.out
+ * kludge"), so that the raw image can be passed to -kernel.
+ */
+static const uint32_t mb_header[] = {
+    0x1badb002,                             /* magic */
+    0x00010000,                             /* flags: address fields */
+    -(0x1badb002 + 0x00010000),             /* checksum */
+    LOAD_ADDR,                              /* header_addr */
+    LOAD_ADDR,                              /* load_addr */
+    0,                                      /* load_end_addr: whole file */
+    0,                                      /* bss_end_addr */
+    LOAD_ADDR + ENTRY_OFFSET,               /* entry_addr */
+};
+
+/*
+ * Patch the immediate of the instruction on the next page and run it,
+ * forever.  Each round invalidates the previous translation of that page,
+ * but the space it took in the code cache is only reclaimed once the cache
+ * is full.
+ */
+static const uint8_t code_loop[] = {
+    0x31, 0xc9,                             /* xor  %ecx,%ecx */
+    0x41,                                   /* 1: inc %ecx */
+    0x89, 0x0d, 0x01, 0x10, 0x10, 0x00,     /* mov  %ecx,0x101001 */
+    0xe9, 0xd2, 0x0f, 0x00, 0x00,           /* jmp  0x101000 */
+    0xeb, 0xf2                              /* 2: jmp 1b */
+};
+
+static const uint8_t code_slot[] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00,           /* mov  $0,%eax */
+    0xe9, 0x24, 0xf0, 0xff, 0xff            /* jmp  2b */
+};
+
+static unsigned jit_stat(QTestState *qts, const char *name)
+{
+    char *info = qtest_hmp(qts, "info jit");
+    const char *p = strstr(info, name);
+    unsigned long val;
+
+    g_assert(p);
+    val = strtoul(p + strlen(name), NULL, 10);
+    g_free(info);
+    return val;
+}
+
+static void test_evict(void)
+{
+    char kernel[] = "/tmp/qtest-tb-evict-XXXXXX";
+    uint8_t image[SLOT_OFFSET + sizeof(code_slot)] = { 0 };
+    QTestState *qts;
+    ssize_t wlen;
+    int fd, i;
+
+    memcpy(image, mb_header, sizeof(mb_header));
+    memcpy(image + ENTRY_OFFSET, code_loop, sizeof(code_loop));
+    memcpy(image + SLOT_OFFSET, code_slot, sizeof(code_slot));
+
+    fd = mkstemp(kernel);
+    g_assert(fd != -1);
+    wlen = write(fd, image, sizeof(image));
+    g_assert(wlen == sizeof(image));
+    close(fd);
+
+    /* Small enough to fill quickly, but still split into several regions */
+    qts = qtest_initf("-machine accel=tcg -tb-size 8 -kernel %s", kernel);
+    unlink(kernel);
+
+    /* Wait at most 120 seconds for the cache to fill up */
+    for (i = 0; i < 1200 && !jit_stat(qts, "TB eviction count"); i++) {
+        g_usleep(100000);
+    }
+
+    /* The idle region was recycled instead of flushing the whole cache */
+    g_assert_cmpuint(jit_stat(qts, "TB eviction count"), >, 0);
+    g_assert_cmpuint(jit_stat(qts, "TB flush count"), ==, 0);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/tcg/tb-evict", test_evict);
+
+    return g_test_run();
+}
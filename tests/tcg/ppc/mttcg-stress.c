@@ -0,0 +1,177 @@
+/*
+ * Multi-threaded stress test for the PPC memory model under MTTCG
+ *
+ * Exercises, from several guest threads at once:
+ *  - larx/stcx. loops (atomic add and compare-and-swap),
+ *  - lwsync message passing (release/acquire),
+ *  - sync store->load ordering (store buffering litmus test).
+ *
+ * The compiler lowers the __atomic builtins to the lwarx/stwcx.,
+ * ldarx/stdcx., lwsync and sync sequences we want to test.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NR_THREADS  8
+#define NR_ITERS    100000
+#define NR_MESSAGES 20000
+#define NR_SB_ITERS 10000
+
+static uint32_t counter32;
+static uint64_t counter64;
+static uint64_t cas_counter;
+
+static void *atomic_thread(void *arg)
+{
+    int i;
+
+    for (i = 0; i < NR_ITERS; i++) {
+        uint64_t old;
+
+        __atomic_fetch_add(&counter32, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&counter64, 1, __ATOMIC_RELAXED);
+
+        old = __atomic_load_n(&cas_counter, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&cas_counter, &old, old + 1,
+                                            false, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+            /* old has been refreshed, retry */
+        }
+    }
+    return NULL;
+}
+
+static void test_atomics(void)
+{
+    pthread_t th[NR_THREADS];
+    int i;
+
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_create(&th[i], NULL, atomic_thread, NULL);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_join(th[i], NULL);
+    }
+
+    assert(counter32 == (uint32_t)NR_THREADS * NR_ITERS);
+    assert(counter64 == (uint64_t)NR_THREADS * NR_ITERS);
+    assert(cas_counter == (uint64_t)NR_THREADS * NR_ITERS);
+    printf("larx/stcx.: %d threads x %d iterations OK\n",
+           NR_THREADS, NR_ITERS);
+}
+
+/* Message passing: the payload must be visible once the flag is */
+static uint64_t mp_payload;
+static uint64_t mp_flag;
+
+static void *mp_producer(void *arg)
+{
+    uint64_t i;
+
+    for (i = 1; i <= NR_MESSAGES; i++) {
+        while (__atomic_load_n(&mp_flag, __ATOMIC_ACQUIRE) != 0) {
+            sched_yield();
+        }
+        mp_payload = i * 3;
+        __atomic_store_n(&mp_flag, i, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *mp_consumer(void *arg)
+{
+    uint64_t i, seen;
+
+    for (i = 1; i <= NR_MESSAGES; i++) {
+        while ((seen = __atomic_load_n(&mp_flag, __ATOMIC_ACQUIRE)) == 0) {
+            sched_yield();
+        }
+        assert(seen == i);
+        assert(mp_payload == i * 3);
+        __atomic_store_n(&mp_flag, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void test_message_passing(void)
+{
+    pthread_t prod, cons;
+
+    pthread_create(&cons, NULL, mp_consumer, NULL);
+    pthread_create(&prod, NULL, mp_producer, NULL);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    printf("lwsync message passing: %d messages OK\n", NR_MESSAGES);
+}
+
+/*
+ * Store buffering: with a full barrier between each thread's store and
+ * load, at least one of them must observe the other's store.
+ */
+static uint32_t sb_x, sb_y;
+static uint32_t sb_r0, sb_r1;
+static uint32_t sb_start[2], sb_done[2];
+
+static void *sb_thread(void *arg)
+{
+    int me = (intptr_t)arg;
+    uint32_t *mine = me ? &sb_y : &sb_x;
+    uint32_t *other = me ? &sb_x : &sb_y;
+    uint32_t *result = me ? &sb_r1 : &sb_r0;
+    uint32_t i;
+
+    for (i = 1; i <= NR_SB_ITERS; i++) {
+        while (__atomic_load_n(&sb_start[me], __ATOMIC_ACQUIRE) != i) {
+            sched_yield();
+        }
+        __atomic_store_n(mine, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        *result = __atomic_load_n(other, __ATOMIC_RELAXED);
+        __atomic_store_n(&sb_done[me], i, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void test_store_buffering(void)
+{
+    pthread_t th[2];
+    uint32_t i;
+    int j;
+
+    for (j = 0; j < 2; j++) {
+        pthread_create(&th[j], NULL, sb_thread, (void *)(intptr_t)j);
+    }
+    for (i = 1; i <= NR_SB_ITERS; i++) {
+        sb_x = sb_y = 0;
+        for (j = 0; j < 2; j++) {
+            __atomic_store_n(&sb_start[j], i, __ATOMIC_RELEASE);
+        }
+        for (j = 0; j < 2; j++) {
+            while (__atomic_load_n(&sb_done[j], __ATOMIC_ACQUIRE) != i) {
+                sched_yield();
+            }
+        }
+        assert(sb_r0 || sb_r1);
+    }
+    for (j = 0; j < 2; j++) {
+        pthread_join(th[j], NULL);
+    }
+    printf("sync store buffering: %d rounds OK\n", NR_SB_ITERS);
+}
+
+int main(int argc, char **argv)
+{
+    test_atomics();
+    test_message_passing();
+    test_store_buffering();
+    return 0;
+}
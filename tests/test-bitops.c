@@ -133,9 +133,39 @@ static void test_half_unshuffle64(void)
     }
 }
 
+static void test_find_next_nonzero_word_1(void)
+{
+    unsigned long map[512] = { 0 };
+    unsigned long n, start, pos;
+
+    /* All the head, vector and tail cases, with any alignment */
+    for (n = 1; n <= ARRAY_SIZE(map); n += n < 80 ? 1 : 37) {
+        for (start = 0; start < 16 && start <= n; start++) {
+            g_assert_cmpint(find_next_nonzero_word(map, n, start), ==, n);
+            for (pos = start; pos < n; pos++) {
+                map[pos] = 1ul << (pos % BITS_PER_LONG);
+                g_assert_cmpint(find_next_nonzero_word(map, n, start), ==, pos);
+                g_assert_cmpint(find_next_bit(map, n * BITS_PER_LONG,
+                                              start * BITS_PER_LONG), ==,
+                                pos * BITS_PER_LONG + pos % BITS_PER_LONG);
+                map[pos] = 0;
+            }
+        }
+    }
+}
+
+static void test_find_next_nonzero_word(void)
+{
+    do {
+        test_find_next_nonzero_word_1();
+    } while (test_bitmap_scan_next_accel());
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bitops/find_next_nonzero_word",
+                    test_find_next_nonzero_word);
     g_test_add_func("/bitops/sextract32", test_sextract32);
     g_test_add_func("/bitops/sextract64", test_sextract64);
     g_test_add_func("/bitops/half_shuffle32", test_half_shuffle32);
@@ -15,6 +15,7 @@
 #include "libqos/virtio.h"
 #include "libqos/virtio-pci.h"
 #include "libqos/virtio-mmio.h"
+#include "libqos/virtio-packed.h"
 #include "libqos/malloc-generic.h"
 #include "qapi/qmp/qdict.h"
 #include "qemu/bswap.h"
@@ -657,6 +658,82 @@ static void pci_idx(void)
     qtest_shutdown(qs);
 }
 
+static uint16_t packed_blk_request(QVirtQueuePacked *vq, uint64_t req_addr,
+                                   uint32_t type, uint64_t sector)
+{
+    uint8_t hdr[16] = { 0 };
+    QVirtioPackedBuf bufs[] = {
+        { .addr = req_addr, .len = 16 },
+        { .addr = req_addr + 16, .len = 512, .write = type == VIRTIO_BLK_T_IN },
+        { .addr = req_addr + 528, .len = 1, .write = true },
+    };
+
+    /* The device is little endian with VIRTIO_F_VERSION_1 */
+    stl_le_p(hdr, type);
+    stq_le_p(hdr + 8, sector);
+    memwrite(req_addr, hdr, sizeof(hdr));
+    writeb(req_addr + 528, 0xff);
+
+    return qvirtqueue_packed_add(vq, bufs, ARRAY_SIZE(bufs));
+}
+
+static void pci_packed(void)
+{
+    QVirtioPackedDevice *dev;
+    QVirtQueuePacked *vq;
+    QOSState *qs;
+    uint64_t req_addr;
+    char *tmp_path;
+    char data[512], buf[512];
+    uint16_t id;
+    int i;
+
+    tmp_path = drive_create();
+    qs = qtest_pc_boot("-drive if=none,id=drive0,file=%s,format=raw "
+                       "-device virtio-blk-pci,drive=drive0,packed=on,"
+                       "addr=%x.%x", tmp_path, PCI_SLOT, PCI_FN);
+    global_qtest = qs->qts;
+    unlink(tmp_path);
+    g_free(tmp_path);
+
+    dev = qvirtio_packed_device_init(qs->pcibus, QPCI_DEVFN(PCI_SLOT, PCI_FN),
+                                     0);
+    /* A small ring, so that the requests below wrap it several times */
+    vq = qvirtqueue_packed_setup(dev, qs->alloc, 0, 8);
+    qvirtio_packed_set_driver_ok(dev);
+
+    req_addr = guest_alloc(qs->alloc, 529);
+
+    for (i = 0; i < 16; i++) {
+        memset(data, 'a' + i, sizeof(data));
+        memwrite(req_addr + 16, data, sizeof(data));
+        id = packed_blk_request(vq, req_addr, VIRTIO_BLK_T_OUT, i);
+        qvirtqueue_packed_kick(dev, vq);
+        qvirtqueue_packed_wait(vq, id, 3, NULL, QVIRTIO_BLK_TIMEOUT_US);
+        g_assert_cmpint(readb(req_addr + 528), ==, VIRTIO_BLK_S_OK);
+    }
+
+    for (i = 0; i < 16; i++) {
+        uint32_t len;
+
+        memset(data, 'a' + i, sizeof(data));
+        id = packed_blk_request(vq, req_addr, VIRTIO_BLK_T_IN, i);
+        qvirtqueue_packed_kick(dev, vq);
+        qvirtqueue_packed_wait(vq, id, 3, &len, QVIRTIO_BLK_TIMEOUT_US);
+        g_assert_cmpint(len, ==, 513);
+        g_assert_cmpint(readb(req_addr + 528), ==, VIRTIO_BLK_S_OK);
+        memread(req_addr + 16, buf, sizeof(buf));
+        g_assert(memcmp(buf, data, sizeof(data)) == 0);
+    }
+
+    guest_free(qs->alloc, req_addr);
+
+    /* End test */
+    qvirtqueue_packed_cleanup(vq, qs->alloc);
+    qvirtio_packed_device_free(dev);
+    qtest_shutdown(qs);
+}
+
 static void pci_hotplug(void)
 {
     QVirtioPCIDevice *dev;
@@ -760,6 +837,7 @@ int main(int argc, char **argv)
         if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
             qtest_add_func("/virtio/blk/pci/msix", pci_msix);
             qtest_add_func("/virtio/blk/pci/idx", pci_idx);
+            qtest_add_func("/virtio/blk/pci/packed", pci_packed);
         }
         qtest_add_func("/virtio/blk/pci/hotplug", pci_hotplug);
     } else if (strcmp(arch, "arm") == 0) {
@@ -16,6 +16,7 @@
 #include "libqos/libqos-spapr.h"
 #include "libqos/virtio.h"
 #include "libqos/virtio-pci.h"
+#include "libqos/virtio-packed.h"
 #include "qapi/qmp/qdict.h"
 #include "qemu/bswap.h"
 #include "hw/virtio/virtio-net.h"
@@ -287,6 +288,87 @@ static void large_tx(gconstpointer data)
     g_free(dev);
     qtest_shutdown(qs);
 }
+static void pci_packed(void)
+{
+    QVirtioPackedDevice *dev;
+    QVirtQueuePacked *rx, *tx;
+    QOSState *qs;
+    uint64_t req_addr;
+    char test[] = "TEST";
+    char buffer[64];
+    uint8_t hdr[VNET_HDR_SIZE] = { 0 };
+    uint32_t len;
+    uint16_t id;
+    int sv[2], ret, i;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    qs = pci_test_start("-netdev socket,fd=%d,id=hs0 -device "
+                        "virtio-net-pci,netdev=hs0,packed=on,addr=%x.0",
+                        sv[1], PCI_SLOT);
+    dev = qvirtio_packed_device_init(qs->pcibus, QPCI_DEVFN(PCI_SLOT, 0), 0);
+
+    /* Small rings, so that the packets below wrap them several times */
+    rx = qvirtqueue_packed_setup(dev, qs->alloc, 0, 4);
+    tx = qvirtqueue_packed_setup(dev, qs->alloc, 1, 4);
+    qvirtio_packed_set_driver_ok(dev);
+
+    req_addr = guest_alloc(qs->alloc, 64);
+
+    for (i = 0; i < 10; i++) {
+        QVirtioPackedBuf rx_buf = { .addr = req_addr, .len = 64,
+                                    .write = true };
+        QVirtioPackedBuf tx_bufs[] = {
+            { .addr = req_addr, .len = VNET_HDR_SIZE },
+            { .addr = req_addr + VNET_HDR_SIZE, .len = sizeof(test) },
+        };
+        int be_len = htonl(sizeof(test));
+        struct iovec iov[] = {
+            {
+                .iov_base = &be_len,
+                .iov_len = sizeof(be_len),
+            }, {
+                .iov_base = test,
+                .iov_len = sizeof(test),
+            },
+        };
+
+        test[3] = '0' + i;
+
+        /* Receive: one writable descriptor */
+        id = qvirtqueue_packed_add(rx, &rx_buf, 1);
+        qvirtqueue_packed_kick(dev, rx);
+        ret = iov_send(sv[0], iov, 2, 0, sizeof(be_len) + sizeof(test));
+        g_assert_cmpint(ret, ==, sizeof(test) + sizeof(be_len));
+        qvirtqueue_packed_wait(rx, id, 1, &len, QVIRTIO_NET_TIMEOUT_US);
+        g_assert_cmpint(len, ==, VNET_HDR_SIZE + sizeof(test));
+        memread(req_addr + VNET_HDR_SIZE, buffer, sizeof(test));
+        g_assert_cmpstr(buffer, ==, test);
+
+        /* Transmit: header and payload in separate descriptors */
+        memwrite(req_addr, hdr, sizeof(hdr));
+        id = qvirtqueue_packed_add(tx, tx_bufs, ARRAY_SIZE(tx_bufs));
+        qvirtqueue_packed_kick(dev, tx);
+        qvirtqueue_packed_wait(tx, id, 2, NULL, QVIRTIO_NET_TIMEOUT_US);
+
+        ret = qemu_recv(sv[0], &len, sizeof(len), 0);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        g_assert_cmpint(ntohl(len), ==, sizeof(test));
+        ret = qemu_recv(sv[0], buffer, sizeof(test), 0);
+        g_assert_cmpint(ret, ==, sizeof(test));
+        g_assert_cmpstr(buffer, ==, test);
+    }
+
+    guest_free(qs->alloc, req_addr);
+
+    /* End test */
+    close(sv[0]);
+    qvirtqueue_packed_cleanup(tx, qs->alloc);
+    qvirtqueue_packed_cleanup(rx, qs->alloc);
+    qvirtio_packed_device_free(dev);
+    qtest_shutdown(qs);
+}
 #endif
 
 static void hotplug(void)
@@ -316,6 +398,10 @@ int main(int argc, char **argv)
                         (gconstpointer)UINT_MAX, large_tx);
     qtest_add_data_func("/virtio/net/pci/large_tx_net_bufsize",
                         (gconstpointer)NET_BUFSIZE, large_tx);
+    if (strcmp(qtest_get_arch(), "i386") == 0 ||
+        strcmp(qtest_get_arch(), "x86_64") == 0) {
+        qtest_add_func("/virtio/net/pci/packed", pci_packed);
+    }
 #endif
     qtest_add_func("/virtio/net/pci/hotplug", hotplug);
 
@@ -0,0 +1,255 @@
+/*
+ * Vectorized search for non-zero words in large bitmaps
+ *
+ * Dirty bitmaps of big guests are mostly zero during the iterative
+ * phases of migration, so most of the time spent finding dirty pages
+ * goes into skipping empty words.  Do that a vector at a time, with
+ * the same host feature dispatch as buffer_is_zero().
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+
+static unsigned long
+find_nonzero_word_int(const unsigned long *addr, unsigned long nwords,
+                      unsigned long start)
+{
+    unsigned long i = start;
+
+    for (; i + 4 <= nwords; i += 4) {
+        if (addr[i] | addr[i + 1] | addr[i + 2] | addr[i + 3]) {
+            break;
+        }
+    }
+    for (; i < nwords; i++) {
+        if (addr[i]) {
+            return i;
+        }
+    }
+    return nwords;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512F_OPT) || \
+    defined(__SSE2__)
+
+/* Each vectorized function tests four vectors per iteration, starting
+ * from an address aligned to the vector size, and leaves the words that
+ * follow the first non-zero block to find_nonzero_word_int.
+ */
+#define VEC_HEAD(vec)                                                   \
+    for (; i < nwords && ((uintptr_t)(addr + i) & (sizeof(vec) - 1)); i++) { \
+        if (addr[i]) {                                                  \
+            return i;                                                   \
+        }                                                               \
+    }
+
+#define VEC_WORDS(vec)  (4 * sizeof(vec) / sizeof(unsigned long))
+
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512F_OPT)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static unsigned long
+find_nonzero_word_sse2(const unsigned long *addr, unsigned long nwords,
+                       unsigned long start)
+{
+    __m128i zero = _mm_setzero_si128();
+    unsigned long i = start;
+
+    VEC_HEAD(__m128i);
+    for (; i + VEC_WORDS(__m128i) <= nwords; i += VEC_WORDS(__m128i)) {
+        const __m128i *p = (const __m128i *)(addr + i);
+        __m128i t = p[0] | p[1] | p[2] | p[3];
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(t, zero)) != 0xFFFF) {
+            break;
+        }
+    }
+    return find_nonzero_word_int(addr, nwords, i);
+}
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512F_OPT)
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static unsigned long
+find_nonzero_word_avx2(const unsigned long *addr, unsigned long nwords,
+                       unsigned long start)
+{
+    unsigned long i = start;
+
+    VEC_HEAD(__m256i);
+    for (; i + VEC_WORDS(__m256i) <= nwords; i += VEC_WORDS(__m256i)) {
+        const __m256i *p = (const __m256i *)(addr + i);
+        __m256i t = p[0] | p[1] | p[2] | p[3];
+
+        __builtin_prefetch(p + 8);
+        if (!_mm256_testz_si256(t, t)) {
+            break;
+        }
+    }
+    return find_nonzero_word_int(addr, nwords, i);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512F_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#include <immintrin.h>
+
+static unsigned long
+find_nonzero_word_avx512f(const unsigned long *addr, unsigned long nwords,
+                          unsigned long start)
+{
+    unsigned long i = start;
+
+    VEC_HEAD(__m512i);
+    for (; i + VEC_WORDS(__m512i) <= nwords; i += VEC_WORDS(__m512i)) {
+        const __m512i *p = (const __m512i *)(addr + i);
+        __m512i t = _mm512_or_si512(_mm512_or_si512(p[0], p[1]),
+                                    _mm512_or_si512(p[2], p[3]));
+
+        __builtin_prefetch(p + 8);
+        if (_mm512_test_epi64_mask(t, t)) {
+            break;
+        }
+    }
+    return find_nonzero_word_int(addr, nwords, i);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512F_OPT */
+
+/* Note that for test_bitmap_scan_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX512F 1
+#define CACHE_AVX2    2
+#define CACHE_SSE2    4
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512F_OPT)
+# define INIT_CACHE 0
+# define INIT_ACCEL find_nonzero_word_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL find_nonzero_word_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static unsigned long (*scan_accel)(const unsigned long *, unsigned long,
+                                   unsigned long) = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    unsigned long (*fn)(const unsigned long *, unsigned long,
+                        unsigned long) = find_nonzero_word_int;
+
+    if (cache & CACHE_SSE2) {
+        fn = find_nonzero_word_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = find_nonzero_word_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512F_OPT
+    if (cache & CACHE_AVX512F) {
+        fn = find_nonzero_word_avx512f;
+    }
+#endif
+    scan_accel = fn;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512F_OPT)
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* 0xe6: the opmask and upper ZMM state are enabled as well */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512F)) {
+                cache |= CACHE_AVX512F;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT || CONFIG_AVX512F_OPT */
+
+bool test_bitmap_scan_next_accel(void)
+{
+    /* If no bits set, we just tested find_nonzero_word_int, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+static unsigned long select_accel_fn(const unsigned long *addr,
+                                     unsigned long nwords,
+                                     unsigned long start)
+{
+    if (likely(nwords - start >= 32)) {
+        return scan_accel(addr, nwords, start);
+    }
+    return find_nonzero_word_int(addr, nwords, start);
+}
+
+#else
+#define select_accel_fn  find_nonzero_word_int
+bool test_bitmap_scan_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+ * Returns the index of the first non-zero word of @addr in
+ * [@start, @nwords), or @nwords if all of them are zero.
+ */
+unsigned long find_next_nonzero_word(const unsigned long *addr,
+                                     unsigned long nwords,
+                                     unsigned long start)
+{
+    if (unlikely(start >= nwords)) {
+        return nwords;
+    }
+    return select_accel_fn(addr, nwords, start);
+}
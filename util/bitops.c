@@ -41,6 +41,15 @@ unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
         size -= BITS_PER_LONG;
         result += BITS_PER_LONG;
     }
+    if (size >= 32 * BITS_PER_LONG) {
+        /* Long sparse bitmaps: skip the zero words a vector at a time */
+        unsigned long skip = find_next_nonzero_word(p, size / BITS_PER_LONG,
+                                                    0);
+
+        p += skip;
+        result += skip * BITS_PER_LONG;
+        size -= skip * BITS_PER_LONG;
+    }
     while (size >= 4*BITS_PER_LONG) {
         unsigned long d1, d2, d3;
         tmp = *p;
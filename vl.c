@@ -137,6 +137,9 @@ int main(int argc, char **argv)
 extern const char *aflFile;
 extern unsigned long aflPanicAddr;
 extern unsigned long aflDmesgAddr;
+extern unsigned long aflFuzzClock;
+extern int aflIdleWarp;
+extern unsigned char afl_fork_child;
 
 static const char *data_dir[16];
 static int data_dir_idx;
@@ -316,6 +319,10 @@ static QemuOptsList qemu_accel_opts = {
             .name = "thread",
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
+        }, {
+            .name = "dirty-ring-size",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Entries of the per-vCPU dirty page rings (TCG)",
         },
         { /* end of list */ }
     },
@@ -506,6 +513,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrbuf",
+            .type = QEMU_OPT_SIZE,
         },
         { /* end of list */ }
     },
@@ -1689,6 +1699,7 @@ void qemu_system_reset(ShutdownCause reason)
 void qemu_system_guest_panicked(GuestPanicInformation *info)
 {
     qemu_log_mask(LOG_GUEST_ERROR, "Guest crashed");
+    replay_fork_save_log();
 
     if (current_cpu) {
         current_cpu->crash_occurred = true;
@@ -3016,6 +3027,7 @@ int main(int argc, char **argv, char **envp)
     int optind;
     const char *optarg;
     const char *loadvm = NULL;
+    const char *loadvm_mapped = NULL;
     MachineClass *machine_class;
     const char *cpu_model;
     const char *vga_model = NULL;
@@ -3297,7 +3309,13 @@ int main(int argc, char **argv, char **envp)
                 break;
             case QEMU_OPTION_aflDmesgAddr:
                 aflDmesgAddr = strtoul(optarg, NULL, 16);
-break;
+                break;
+            case QEMU_OPTION_aflFuzzClock:
+                aflFuzzClock = strtoul(optarg, NULL, 0);
+                break;
+            case QEMU_OPTION_aflIdleWarp:
+                aflIdleWarp = 1;
+                break;
 #ifdef CONFIG_LIBISCSI
             case QEMU_OPTION_iscsi:
                 opts = qemu_opts_parse_noisily(qemu_find_opts("iscsi"),
@@ -3602,6 +3620,9 @@ break;
             case QEMU_OPTION_loadvm:
                 loadvm = optarg;
                 break;
+            case QEMU_OPTION_loadvm_mapped:
+                loadvm_mapped = optarg;
+                break;
             case QEMU_OPTION_full_screen:
                 dpy.has_full_screen = true;
                 dpy.full_screen = true;
@@ -4647,9 +4668,26 @@ break;
             exit(1);
         }
     }
+    if (loadvm_mapped) {
+        Error *local_err = NULL;
+        if (load_mapped_snapshot(loadvm_mapped, &local_err) < 0) {
+            error_report_err(local_err);
+            autostart = 0;
+            exit(1);
+        }
+    }
     if (replay_mode != REPLAY_MODE_NONE) {
         replay_vmstate_init();
     }
+    if (replay_mode == REPLAY_MODE_PLAY && replay_is_fork_log()) {
+        if (!loadvm_mapped) {
+            error_report("a log recorded with rr=record-fork must be "
+                         "replayed from its snapshot, use -loadvm-mapped");
+            exit(1);
+        }
+        /* The log starts in a fork server child */
+        afl_fork_child = 1;
+    }
 
     qdev_prop_check_globals();
     if (vmstate_dump_file) {